@@ -12,6 +12,7 @@
 #include "open.h"
 #include "seek.h"
 #include "cdb.h"
+#include "clientloc.h"
 #include "stralloc.h"
 #include "strerr.h"
 #include "str.h"
@@ -128,7 +129,8 @@ unsigned long port;
 char clientloc[2];
 
 struct tai now;
-char data[32767];
+char databuf[32767];
+char *data;
 uint32 dlen;
 uint32 dpos;
 
@@ -220,11 +222,23 @@ static char *q;
 static stralloc soa;
 static stralloc message;
 
+/* mapped: point into the map; otherwise: next bytes of a sequential read */
+static char *walk(char *buf,unsigned int len,uint32 pos)
+{
+  char *x;
+
+  if (!c.map) { get(buf,len); return buf; }
+  x = cdb_getptr(&c,buf,len,pos);
+  if (!x) die_cdbread();
+  return x;
+}
+
 void doaxfr(char id[2])
 {
   char key[512];
   uint32 klen;
-  char num[4];
+  char num[8];
+  char *x;
   uint32 eod;
   uint32 pos;
   int r;
@@ -234,18 +248,8 @@ void doaxfr(char id[2])
   tai_now(&now);
   cdb_init(&c,fdcdb);
 
-  byte_zero(clientloc,2);
-  key[0] = 0;
-  key[1] = '%';
-  byte_copy(key + 2,4,ip);
-  r = cdb_find(&c,key,6);
-  if (!r) r = cdb_find(&c,key,5);
-  if (!r) r = cdb_find(&c,key,4);
-  if (!r) r = cdb_find(&c,key,3);
-  if (!r) r = cdb_find(&c,key,2);
-  if (r == -1) die_cdbread();
-  if (r && (cdb_datalen(&c) == 2))
-    if (cdb_read(&c,clientloc,2,cdb_datapos(&c)) == -1) die_cdbread();
+  if (!clientloc_load(&c,"\0%",2)) die_cdbread();
+  clientloc_find(clientloc,ip);
 
   cdb_findstart(&c);
   for (;;) {
@@ -253,46 +257,47 @@ void doaxfr(char id[2])
     if (r == -1) die_cdbread();
     if (!r) die_outside();
     dlen = cdb_datalen(&c);
-    if (dlen > sizeof data) die_cdbformat();
-    if (cdb_read(&c,data,dlen,cdb_datapos(&c)) == -1) die_cdbformat();
+    if (dlen > sizeof databuf) die_cdbformat();
+    data = cdb_getptr(&c,databuf,dlen,cdb_datapos(&c));
+    if (!data) die_cdbformat();
     if (build(&soa,zone,1,id)) break;
   }
 
-  cdb_free(&c);
   print(soa.s,soa.len);
 
-  seek_begin(fdcdb);
-  buffer_init(&bcdb,buffer_unixread,fdcdb,bcdbspace,sizeof bcdbspace);
-
-  pos = 0;
-  get(num,4); pos += 4;
+  if (cdb_read(&c,num,4,0) == -1) die_cdbread();
   uint32_unpack(num,&eod);
-  while (pos < 2048) { get(num,4); pos += 4; }
+  pos = 2048;
+  if (c.version == 2) pos += 8; /* CDB2_MAGIC */
+  if (!c.map) {
+    if (seek_set(fdcdb,(seek_pos) pos) == -1) die_cdbread();
+    buffer_init(&bcdb,buffer_unixread,fdcdb,bcdbspace,sizeof bcdbspace);
+  }
 
   while (pos < eod) {
     if (eod - pos < 8) die_cdbformat();
-    get(num,4); pos += 4;
-    uint32_unpack(num,&klen);
-    get(num,4); pos += 4;
-    uint32_unpack(num,&dlen);
+    x = walk(num,8,pos);
+    pos += 8;
+    uint32_unpack(x,&klen);
+    uint32_unpack(x + 4,&dlen);
     if (eod - pos < klen) die_cdbformat();
+    if (klen > sizeof key) die_cdbformat();
+    x = walk(key,klen,pos);
     pos += klen;
     if (eod - pos < dlen) die_cdbformat();
+    if (dlen > sizeof databuf) die_cdbformat();
+    data = walk(databuf,dlen,pos);
     pos += dlen;
 
-    if (klen > sizeof key) die_cdbformat();
-    get(key,klen);
-    if (dlen > sizeof data) die_cdbformat();
-    get(data,dlen);
-
-    if ((klen > 1) && (key[0] == 0)) continue; /* location */
+    if ((klen > 1) && (x[0] == 0)) continue; /* location */
     if (klen < 1) die_cdbformat();
-    if (dns_packet_getname(key,klen,0,&q) != klen) die_cdbformat();
+    if (dns_packet_getname(x,klen,0,&q) != klen) die_cdbformat();
     if (!dns_domain_suffix(q,zone)) continue;
     if (!build(&message,q,0,id)) continue;
     print(message.s,message.len);
   }
 
+  cdb_free(&c);
   print(soa.s,soa.len);
 }
 
@@ -1,48 +1,107 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "alloc.h"
+#include "buffer.h"
 #include "byte.h"
+#include "error.h"
 #include "uint32.h"
 #include "exit.h"
 #include "tai.h"
 #include "cache.h"
 
-uint64 cache_motion = 0;
+#define SLOTS CACHE_SLOTS
 
+uint64 cache_motion = 0;
+uint64 cache_hits = 0;
+uint64 cache_misses = 0;
+uint64 cache_expired = 0; /* found, but expired */
+uint64 cache_displaced = 0; /* reachable entries pushed out of full buckets */
+uint64 cache_evicted = 0; /* bytes reclaimed from the tail */
+uint64 cache_occupancy[2 * SLOTS + 1]; /* lookups, by entries in the two buckets */
+uint64 cache_typehits[257]; /* hits by type in the first 2 key bytes; 256: other */
+int cache_refresh = 0;
+
+static unsigned int refreshhits = 0;
+static unsigned int refreshpercent = 0;
+
+struct bucket {
+  uint32 tag[SLOTS]; /* 16 bits of hash of name, then type */
+  uint32 pos[SLOTS]; /* position of entry in x, or 0 */
+} ;
+
+static char *space = 0;
 static char *x = 0;
+static struct bucket *b;
 static uint32 size;
 static uint32 hsize;
+static uint32 bmask;
 static uint32 writer;
 static uint32 oldest;
 static uint32 unused;
 
 /*
 100 <= size <= 1000000000.
-4 <= hsize <= size/16.
+64 <= hsize <= max(64,size/8).
 hsize is a power of 2.
 
 hsize <= writer <= oldest <= unused <= size.
 If oldest == unused then unused == size.
 
-x is a hash table with the following structure:
-x[0...hsize-1]: hsize/4 head links.
+x is 64-byte aligned, with the following structure:
+x[0...hsize-1]: hsize/64 buckets, one cache line each.
 x[hsize...writer-1]: consecutive entries, newest entry on the right.
 x[writer...oldest-1]: free space for new entries.
 x[oldest...unused-1]: consecutive entries, oldest entry on the left.
 x[unused...size-1]: unused.
 
-Each hash bucket is a linked list containing the following items:
-the head link, the newest entry, the second-newest entry, etc.
-Each link is a 4-byte number giving the xor of
-the positions of the adjacent items in the list.
-
-Entries are always inserted immediately after the head and removed at the tail.
+A key is a 2-byte type followed by a name. The name alone hashes to
+two buckets, each holding up to 8 entries as a 4-byte tag and the entry
+position, so a lookup reads at most two cache lines and compares keys
+only on a tag match. The tag is 16 bits of the hash and the type, so
+all types of one name sit in the same two buckets and cache_type()
+tells them apart without touching the entries. A new entry goes into a
+free slot in either bucket; if both are full, it replaces the oldest of
+their 16 entries, which stays in x, unreachable, until it reaches the tail.
 
 Each entry contains the following information:
-4-byte link; 4-byte keylen; 4-byte datalen; 8-byte expire time; key; data.
+4-byte keylen; 4-byte datalen; 8-byte expire time; 4-byte ttl as
+set; 4-byte hit count; key; data.
+Entries are always inserted at writer and removed at oldest.
 */
 
 #define MAXKEYLEN 1000
 #define MAXDATALEN 1000000
 
+static struct tai clocknow;
+static int flagclock = 0;
+
+/* t is the time as of the current event-loop pass; 0: call tai_now() */
+void cache_clock(const struct tai *t)
+{
+  flagclock = 0;
+  if (!t) return;
+  clocknow = *t;
+  flagclock = 1;
+}
+
+static void gettime(struct tai *t)
+{
+  if (flagclock)
+    *t = clocknow;
+  else
+    tai_now(t);
+}
+
+/* flag hits on entries hit hits times, in the last percent of their ttl */
+void cache_refreshat(unsigned int hits,unsigned int percent)
+{
+  if (percent > 100) percent = 100;
+  refreshhits = hits;
+  refreshpercent = percent;
+}
+
 static void cache_impossible(void)
 {
   _exit(111);
@@ -62,9 +121,9 @@ static uint32 get4(uint32 pos)
   return result;
 }
 
-static unsigned int hash(const char *key,unsigned int keylen)
+static uint32 hash(const char *key,unsigned int keylen)
 {
-  unsigned int result = 5381;
+  uint32 result = 5381;
 
   while (keylen) {
     result = (result << 5) + result;
@@ -72,74 +131,171 @@ static unsigned int hash(const char *key,unsigned int keylen)
     ++key;
     --keylen;
   }
-  result <<= 2;
-  result &= hsize - 4;
+  result ^= result >> 16; /* spread the low bits, which pick the bucket */
+  result *= 0x85ebca6b;
+  result ^= result >> 13;
   return result;
 }
 
-char *cache_get(const char *key,unsigned int keylen,unsigned int *datalen,uint32 *ttl)
+/* the name: all of the key after the type */
+static uint32 keyhash(const char *key,unsigned int keylen)
+{
+  if (keylen < 2) return hash(key,keylen);
+  return hash(key + 2,keylen - 2);
+}
+
+static uint32 keytag(uint32 h,const char *key,unsigned int keylen)
+{
+  uint32 result;
+
+  result = (h * 0x9e3779b1) & 0xffff0000; /* mixed: h picks the buckets */
+  if (keylen >= 2)
+    result |= ((uint32) (unsigned char) key[0] << 8) | (unsigned char) key[1];
+  return result;
+}
+
+static uint32 age(uint32 pos)
+{
+  if (pos >= oldest) return (unused - pos) + (writer - hsize);
+  return writer - pos;
+}
+
+static void buckets(struct bucket *t[2],uint32 h)
+{
+  t[0] = b + (h & bmask);
+  t[1] = b + (((h >> 16) | (h << 16)) & bmask);
+}
+
+/* slot s of the pair is slot s % SLOTS of bucket s / SLOTS */
+#define TAG(t,s) ((t)[(s) / SLOTS]->tag[(s) % SLOTS])
+#define POS(t,s) ((t)[(s) / SLOTS]->pos[(s) % SLOTS])
+
+static int slot(struct bucket *t[2],uint32 tag,const char *key,unsigned int keylen)
+{
+  uint32 pos;
+  int s;
+
+  for (s = 0;s < 2 * SLOTS;++s)
+    if (TAG(t,s) == tag) {
+      pos = POS(t,s);
+      if (!pos) continue;
+      if (get4(pos) != keylen) continue;
+      if (pos + 24 + keylen > size) cache_impossible();
+      if (byte_equal(key,keylen,x + pos + 24)) return s;
+    }
+  return -1;
+}
+
+static void occupancy(struct bucket *t[2])
+{
+  unsigned int n;
+  int s;
+
+  n = 0;
+  for (s = 0;s < 2 * SLOTS;++s)
+    if (POS(t,s)) ++n;
+  ++cache_occupancy[n];
+}
+
+static char *found(uint32 pos,const char *key,unsigned int keylen,unsigned int *datalen,uint32 *ttl)
 {
   struct tai expire;
   struct tai now;
-  uint32 pos;
-  uint32 prevpos;
-  uint32 nextpos;
   uint32 u;
-  unsigned int loop;
   double d;
 
+  tai_unpack(x + pos + 8,&expire);
+  gettime(&now);
+  if (tai_less(&expire,&now)) { ++cache_expired; return 0; }
+
+  ++cache_hits;
+  if ((keylen >= 2) && !key[0])
+    ++cache_typehits[(unsigned char) key[1]];
+  else
+    ++cache_typehits[256];
+
+  tai_sub(&expire,&expire,&now);
+  d = tai_approx(&expire);
+  if (d > 604800) d = 604800;
+  *ttl = d;
+
+  u = get4(pos + 20) + 1;
+  if (refreshhits && (u >= refreshhits))
+    if (d * 100 <= (double) get4(pos + 16) * refreshpercent) {
+      cache_refresh = 1;
+      u = 0; /* once per refreshhits hits */
+    }
+  set4(pos + 20,u);
+
+  u = get4(pos + 4);
+  if (u > size - pos - 24 - keylen) cache_impossible();
+  *datalen = u;
+
+  return x + pos + 24 + keylen;
+}
+
+char *cache_get(const char *key,unsigned int keylen,unsigned int *datalen,uint32 *ttl)
+{
+  struct bucket *t[2];
+  uint32 h;
+  int s;
+
   if (!x) return 0;
   if (keylen > MAXKEYLEN) return 0;
 
-  prevpos = hash(key,keylen);
-  pos = get4(prevpos);
-  loop = 0;
-
-  while (pos) {
-    if (get4(pos + 4) == keylen) {
-      if (pos + 20 + keylen > size) cache_impossible();
-      if (byte_equal(key,keylen,x + pos + 20)) {
-        tai_unpack(x + pos + 12,&expire);
-        tai_now(&now);
-        if (tai_less(&expire,&now)) return 0;
+  h = keyhash(key,keylen);
+  buckets(t,h);
+  occupancy(t);
+  s = slot(t,keytag(h,key,keylen),key,keylen);
+  if (s == -1) { ++cache_misses; return 0; }
+  return found(POS(t,s),key,keylen,datalen,ttl);
+}
 
-        tai_sub(&expire,&expire,&now);
-        d = tai_approx(&expire);
-        if (d > 604800) d = 604800;
-        *ttl = d;
+/*
+cache_name(name) then cache_type(type) is cache_get(type and name),
+but the name is hashed and its buckets found once for all types.
+*/
 
-        u = get4(pos + 8);
-        if (u > size - pos - 20 - keylen) cache_impossible();
-        *datalen = u;
+static struct bucket *probe[2];
+static uint32 probeh;
+static char probekey[MAXKEYLEN];
+static unsigned int probekeylen = 0; /* 0: no name */
 
-        return x + pos + 20 + keylen;
-      }
-    }
-    nextpos = prevpos ^ get4(pos);
-    prevpos = pos;
-    pos = nextpos;
-    if (++loop > 100) return 0; /* to protect against hash flooding */
-  }
+void cache_name(const char *name,unsigned int len)
+{
+  probekeylen = 0;
+  if (!x) return;
+  if (len > MAXKEYLEN - 2) return;
 
-  return 0;
+  probeh = hash(name,len);
+  buckets(probe,probeh);
+  occupancy(probe);
+  byte_copy(probekey + 2,len,name);
+  probekeylen = len + 2;
 }
 
-void cache_set(const char *key,unsigned int keylen,const char *data,unsigned int datalen,uint32 ttl)
+char *cache_type(const char type[2],unsigned int *datalen,uint32 *ttl)
 {
-  struct tai now;
-  struct tai expire;
-  unsigned int entrylen;
-  unsigned int keyhash;
-  uint32 pos;
+  int s;
 
-  if (!x) return;
-  if (keylen > MAXKEYLEN) return;
-  if (datalen > MAXDATALEN) return;
+  if (!probekeylen) return 0;
+  byte_copy(probekey,2,type);
+  s = slot(probe,keytag(probeh,probekey,probekeylen),probekey,probekeylen);
+  if (s == -1) { ++cache_misses; return 0; }
+  return found(POS(probe,s),probekey,probekeylen,datalen,ttl);
+}
 
-  if (!ttl) return;
-  if (ttl > 604800) ttl = 604800;
+static void insert(const char *key,unsigned int keylen,const char *data,unsigned int datalen,struct tai *expire,uint32 ttl)
+{
+  struct bucket *t[2];
+  unsigned int entrylen;
+  uint32 h;
+  uint32 len;
+  int free[2];
+  int s;
+  int i;
 
-  entrylen = keylen + datalen + 20;
+  entrylen = keylen + datalen + 24;
 
   while (writer + entrylen > oldest) {
     if (oldest == unused) {
@@ -149,10 +305,16 @@ void cache_set(const char *key,unsigned int keylen,const char *data,unsigned int
       writer = hsize;
     }
 
-    pos = get4(oldest);
-    set4(pos,get4(pos) ^ oldest);
+    len = get4(oldest);
+    if (oldest + 24 + len > unused) cache_impossible();
+    buckets(t,keyhash(x + oldest + 24,len));
+    for (s = 0;s < 2 * SLOTS;++s)
+      if (POS(t,s) == oldest)
+        POS(t,s) = 0;
   
-    oldest += get4(oldest + 4) + get4(oldest + 8) + 20;
+    len += get4(oldest + 4) + 24;
+    oldest += len;
+    cache_evicted += len;
     if (oldest > unused) cache_impossible();
     if (oldest == unused) {
       unused = size;
@@ -160,31 +322,173 @@ void cache_set(const char *key,unsigned int keylen,const char *data,unsigned int
     }
   }
 
-  keyhash = hash(key,keylen);
+  h = keyhash(key,keylen);
+  buckets(t,h);
+  h = keytag(h,key,keylen);
+  s = slot(t,h,key,keylen);
+  if (s == -1) {
+    free[0] = free[1] = 0;
+    for (i = 0;i < 2 * SLOTS;++i)
+      if (!POS(t,i)) ++free[i / SLOTS];
+    for (i = 0;i < 2 * SLOTS;++i) {
+      if (!POS(t,i)) {
+        if (free[i / SLOTS] < free[1 - i / SLOTS]) continue; /* balance */
+        s = i;
+        break;
+      }
+      if ((s == -1) || (age(POS(t,i)) > age(POS(t,s)))) s = i;
+    }
+    if (POS(t,s)) ++cache_displaced;
+  }
 
-  tai_now(&now);
-  tai_uint(&expire,ttl);
-  tai_add(&expire,&expire,&now);
+  set4(writer,keylen);
+  set4(writer + 4,datalen);
+  tai_pack(x + writer + 8,expire);
+  set4(writer + 16,ttl);
+  set4(writer + 20,0);
+  byte_copy(x + writer + 24,keylen,key);
+  byte_copy(x + writer + 24 + keylen,datalen,data);
 
-  pos = get4(keyhash);
-  if (pos)
-    set4(pos,get4(pos) ^ keyhash ^ writer);
-  set4(writer,pos ^ keyhash);
-  set4(writer + 4,keylen);
-  set4(writer + 8,datalen);
-  tai_pack(x + writer + 12,&expire);
-  byte_copy(x + writer + 20,keylen,key);
-  byte_copy(x + writer + 20 + keylen,datalen,data);
-
-  set4(keyhash,writer);
+  TAG(t,s) = h;
+  POS(t,s) = writer;
   writer += entrylen;
   cache_motion += entrylen;
 }
 
+void cache_set(const char *key,unsigned int keylen,const char *data,unsigned int datalen,uint32 ttl)
+{
+  struct tai now;
+  struct tai expire;
+
+  if (!x) return;
+  if (keylen > MAXKEYLEN) return;
+  if (datalen > MAXDATALEN) return;
+
+  if (!ttl) return;
+  if (ttl > 604800) ttl = 604800;
+
+  gettime(&now);
+  tai_uint(&expire,ttl);
+  tai_add(&expire,&expire,&now);
+
+  insert(key,keylen,data,datalen,&expire,ttl);
+}
+
+/*
+A dump file starts with a header: the 8 bytes "dnscache", a 4-byte
+version of the entry format, and the 4-byte header length. Then the
+entries in the format above, oldest first: only entries still
+reachable through the index and not yet expired. cache_load() refuses
+a file with any other header.
+*/
+
+#define DUMPVERSION 1
+#define DUMPHEADER 16
+
+static int live(uint32 pos,struct tai *now)
+{
+  struct bucket *t[2];
+  struct tai expire;
+  uint32 keylen;
+  int s;
+
+  keylen = get4(pos);
+  tai_unpack(x + pos + 8,&expire);
+  if (tai_less(&expire,now)) return 0;
+  buckets(t,keyhash(x + pos + 24,keylen));
+  for (s = 0;s < 2 * SLOTS;++s)
+    if (POS(t,s) == pos) return 1;
+  return 0;
+}
+
+static int dumprange(buffer *bb,uint32 pos,uint32 end,struct tai *now)
+{
+  uint32 len;
+
+  while (pos < end) {
+    len = get4(pos) + get4(pos + 4) + 24;
+    if (len > end - pos) cache_impossible();
+    if (live(pos,now))
+      if (buffer_put(bb,x + pos,len) == -1) return -1;
+    pos += len;
+  }
+  return 0;
+}
+
+int cache_dump(int fd)
+{
+  struct tai now;
+  char header[DUMPHEADER];
+  char outspace[8192];
+  buffer bb;
+
+  if (!x) return 0;
+  buffer_init(&bb,buffer_unixwrite,fd,outspace,sizeof outspace);
+  byte_copy(header,8,"dnscache");
+  uint32_pack(header + 8,DUMPVERSION);
+  uint32_pack(header + 12,DUMPHEADER);
+  if (buffer_put(&bb,header,DUMPHEADER) == -1) return -1;
+  gettime(&now);
+  if (dumprange(&bb,oldest,unused,&now) == -1) return -1;
+  if (dumprange(&bb,hsize,writer,&now) == -1) return -1;
+  return buffer_flush(&bb);
+}
+
+int cache_load(int fd)
+{
+  struct stat st;
+  struct tai now;
+  struct tai expire;
+  char *map;
+  uint32 pos;
+  uint32 keylen;
+  uint32 datalen;
+  uint32 ttl;
+  uint32 u;
+
+  if (!x) return 0;
+  if (fstat(fd,&st) == -1) return -1;
+  if (st.st_size > 0xffffffff) { errno = error_proto; return -1; }
+  if (!st.st_size) return 0;
+  map = mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+  if (map == (char *) -1) return -1;
+
+  errno = error_proto;
+  if (st.st_size < DUMPHEADER) goto REFUSE;
+  if (byte_diff(map,8,"dnscache")) goto REFUSE;
+  uint32_unpack(map + 8,&u);
+  if (u != DUMPVERSION) goto REFUSE;
+  uint32_unpack(map + 12,&u);
+  if (u != DUMPHEADER) goto REFUSE;
+
+  gettime(&now);
+  pos = DUMPHEADER;
+  while (st.st_size - pos >= 24) {
+    uint32_unpack(map + pos,&keylen);
+    uint32_unpack(map + pos + 4,&datalen);
+    if (keylen > MAXKEYLEN) break;
+    if (datalen > MAXDATALEN) break;
+    if (st.st_size - pos - 24 < keylen + datalen) break;
+    tai_unpack(map + pos + 8,&expire);
+    uint32_unpack(map + pos + 16,&ttl);
+    if (!tai_less(&expire,&now))
+      insert(map + pos + 24,keylen,map + pos + 24 + keylen,datalen,&expire,ttl);
+    pos += 24 + keylen + datalen;
+  }
+
+  munmap(map,st.st_size);
+  return 0;
+
+  REFUSE:
+  munmap(map,st.st_size);
+  return -1;
+}
+
 int cache_init(unsigned int cachesize)
 {
-  if (x) {
-    alloc_free(x);
+  if (space) {
+    alloc_free(space);
+    space = 0;
     x = 0;
   }
 
@@ -192,12 +496,15 @@ int cache_init(unsigned int cachesize)
   if (cachesize < 100) cachesize = 100;
   size = cachesize;
 
-  hsize = 4;
-  while (hsize <= (size >> 5)) hsize <<= 1;
+  hsize = 64;
+  while (hsize <= (size >> 4)) hsize <<= 1;
+  bmask = hsize / sizeof(struct bucket) - 1;
 
-  x = alloc(size);
-  if (!x) return 0;
+  space = alloc(size + 64);
+  if (!space) return 0;
+  x = space + ((64 - ((unsigned long) space & 63)) & 63);
   byte_zero(x,size);
+  b = (struct bucket *) x;
 
   writer = hsize;
   oldest = size;
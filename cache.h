@@ -3,10 +3,27 @@
 
 #include "uint32.h"
 #include "uint64.h"
+#include "tai.h"
+
+#define CACHE_SLOTS 8 /* per bucket; a key has two buckets */
 
 extern uint64 cache_motion;
+extern uint64 cache_hits;
+extern uint64 cache_misses;
+extern uint64 cache_expired;
+extern uint64 cache_displaced;
+extern uint64 cache_evicted;
+extern uint64 cache_occupancy[];
+extern uint64 cache_typehits[];
 extern int cache_init(unsigned int);
 extern void cache_set(const char *,unsigned int,const char *,unsigned int,uint32);
 extern char *cache_get(const char *,unsigned int,unsigned int *,uint32 *);
+extern void cache_name(const char *,unsigned int);
+extern char *cache_type(const char *,unsigned int *,uint32 *);
+extern void cache_clock(const struct tai *);
+extern void cache_refreshat(unsigned int,unsigned int);
+extern int cache_refresh; /* set by cache_get() when an entry is due for refresh */
+extern int cache_dump(int);
+extern int cache_load(int);
 
 #endif
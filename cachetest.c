@@ -1,7 +1,126 @@
 #include "buffer.h"
 #include "exit.h"
 #include "cache.h"
+#include "oldcache.h"
 #include "str.h"
+#include "byte.h"
+#include "fmt.h"
+#include "taia.h"
+
+#define BENCHSIZE 10000000
+#define BENCHKEYS 100000
+#define BENCHGETS 2000000
+
+static char key[32];
+static unsigned int keylen;
+
+static void mkkey(unsigned long n)
+{
+  byte_copy(key,2,"\0\1");
+  key[3] = 'h';
+  key[2] = 1 + fmt_ulong(key + 4,n);
+  keylen = 3 + key[2];
+  byte_copy(key + keylen,9,"\4test\3bm\0");
+  keylen += 9;
+}
+
+static void put(const char *name,const char *what,struct taia *start,unsigned long n)
+{
+  struct taia stop;
+  char strnum[FMT_ULONG];
+
+  taia_now(&stop);
+  taia_sub(&stop,&stop,start);
+  buffer_puts(buffer_1,name);
+  buffer_puts(buffer_1,what);
+  buffer_put(buffer_1,strnum,fmt_ulong(strnum,(unsigned long) (taia_approx(&stop) * 1000000000.0 / n)));
+  buffer_puts(buffer_1," ns/op");
+}
+
+static void getbench(const char *name,char *(*get)(const char *,unsigned int,unsigned int *,uint32 *))
+{
+  struct taia start;
+  char strnum[FMT_ULONG];
+  unsigned long i;
+  unsigned long r;
+  unsigned long hits;
+  unsigned int u;
+  uint32 ttl;
+
+  hits = 0;
+  r = 1;
+  taia_now(&start);
+  for (i = 0;i < BENCHGETS;++i) {
+    r = (r * 1103515245 + 12345) & 0x7fffffff;
+    mkkey((r >> 8) % BENCHKEYS);
+    if (get(key,keylen,&u,&ttl)) ++hits;
+  }
+  put(name," get ",&start,BENCHGETS);
+  buffer_puts(buffer_1," ");
+  buffer_put(buffer_1,strnum,fmt_ulong(strnum,hits));
+  buffer_puts(buffer_1," hits\n");
+}
+
+/* a cached A query: the nxdomain and CNAME misses, then the A hit */
+static void querybench(const char *name,int flagname)
+{
+  struct taia start;
+  char strnum[FMT_ULONG];
+  unsigned long i;
+  unsigned long r;
+  unsigned long hits;
+  unsigned int u;
+  uint32 ttl;
+
+  hits = 0;
+  r = 1;
+  taia_now(&start);
+  for (i = 0;i < BENCHGETS;++i) {
+    r = (r * 1103515245 + 12345) & 0x7fffffff;
+    mkkey((r >> 8) % BENCHKEYS);
+    if (flagname) {
+      cache_name(key + 2,keylen - 2);
+      cache_type("\0\377",&u,&ttl);
+      cache_type("\0\5",&u,&ttl);
+      if (cache_type("\0\1",&u,&ttl)) ++hits;
+    }
+    else {
+      byte_copy(key,2,"\0\377");
+      cache_get(key,keylen,&u,&ttl);
+      byte_copy(key,2,"\0\5");
+      cache_get(key,keylen,&u,&ttl);
+      byte_copy(key,2,"\0\1");
+      if (cache_get(key,keylen,&u,&ttl)) ++hits;
+    }
+  }
+  put(name," query ",&start,BENCHGETS);
+  buffer_puts(buffer_1," ");
+  buffer_put(buffer_1,strnum,fmt_ulong(strnum,hits));
+  buffer_puts(buffer_1," hits\n");
+}
+
+static void bench(const char *name,
+  int (*init)(unsigned int),
+  void (*set)(const char *,unsigned int,const char *,unsigned int,uint32),
+  char *(*get)(const char *,unsigned int,unsigned int *,uint32 *))
+{
+  struct taia start;
+  char data[32];
+  unsigned long i;
+
+  if (!init(BENCHSIZE)) _exit(111);
+  byte_zero(data,sizeof data);
+
+  taia_now(&start);
+  for (i = 0;i < BENCHKEYS;++i) {
+    mkkey(i);
+    set(key,keylen,data,sizeof data,86400);
+  }
+  put(name," set ",&start,BENCHKEYS);
+  buffer_puts(buffer_1,"\n");
+
+  getbench(name,get);
+}
 
 int main(int argc,char **argv)
 {
@@ -10,11 +129,24 @@ int main(int argc,char **argv)
   char *y;
   unsigned int u;
   uint32 ttl;
-
-  if (!cache_init(200)) _exit(111);
+  struct tai now;
 
   if (*argv) ++argv;
 
+  if (*argv && str_equal(*argv,"-b")) {
+    bench("old",oldcache_init,oldcache_set,oldcache_get);
+    bench("new",cache_init,cache_set,cache_get);
+    tai_now(&now);
+    cache_clock(&now); /* as dnscache does once per wakeup */
+    getbench("new+clock",cache_get);
+    querybench("new+clock",0);
+    querybench("new+name",1);
+    buffer_flush(buffer_1);
+    _exit(0);
+  }
+
+  if (!cache_init(264)) _exit(111);
+
   while (x = *argv++) {
     i = str_chr(x,':');
     if (x[i])
@@ -26,19 +26,25 @@ void cdb_init(struct cdb *c,int fd)
 {
   struct stat st;
   char *x;
+  char buf[8];
 
   cdb_free(c);
   cdb_findstart(c);
   c->fd = fd;
+  c->version = 1;
 
   if (fstat(fd,&st) == 0)
     if (st.st_size <= 0xffffffff) {
       x = mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
-      if (x + 1) {
+      if (x != (char *) -1) {
 	c->size = st.st_size;
 	c->map = x;
       }
     }
+
+  if (cdb_read(c,buf,8,2048) == 0)
+    if (byte_equal(buf,8,CDB2_MAGIC))
+      c->version = 2;
 }
 
 int cdb_read(struct cdb *c,char *buf,unsigned int len,uint32 pos)
@@ -67,11 +73,54 @@ int cdb_read(struct cdb *c,char *buf,unsigned int len,uint32 pos)
   return -1;
 }
 
+/* len bytes at pos, not to be written: in the map, or read into buf */
+char *cdb_getptr(struct cdb *c,char *buf,unsigned int len,uint32 pos)
+{
+  if (c->map) {
+    if ((pos > c->size) || (c->size - pos < len)) {
+      errno = error_proto;
+      return 0;
+    }
+    return c->map + pos;
+  }
+  if (cdb_read(c,buf,len,pos) == -1) return 0;
+  return buf;
+}
+
+/* the fixed-size inner loop compiles to vector compares */
+static int keyequal(const char *x,const char *y,unsigned int len)
+{
+  unsigned char d;
+  unsigned int i;
+
+  while (len >= 16) {
+    d = 0;
+    for (i = 0;i < 16;++i)
+      d |= x[i] ^ y[i];
+    if (d) return 0;
+    x += 16;
+    y += 16;
+    len -= 16;
+  }
+  d = 0;
+  for (i = 0;i < len;++i)
+    d |= x[i] ^ y[i];
+  return !d;
+}
+
 static int match(struct cdb *c,const char *key,unsigned int len,uint32 pos)
 {
   char buf[32];
   int n;
 
+  if (c->map) {
+    if ((pos > c->size) || (c->size - pos < len)) {
+      errno = error_proto;
+      return -1;
+    }
+    return keyequal(c->map + pos,key,len);
+  }
+
   while (len > 0) {
     n = sizeof buf;
     if (n > len) n = len;
@@ -89,9 +138,16 @@ int cdb_findnext(struct cdb *c,const char *key,unsigned int len)
   char buf[8];
   uint32 pos;
   uint32 u;
+  uint64 h;
 
   if (!c->loop) {
-    u = cdb_hash(key,len);
+    if (c->version == 2) {
+      h = cdb_hash2(key,len);
+      u = h;
+      c->ktag = h >> 32;
+    }
+    else
+      u = cdb_hash(key,len);
     if (cdb_read(c,buf,8,(u << 3) & 2047) == -1) return -1;
     uint32_unpack(buf + 4,&c->hslots);
     if (!c->hslots) return 0;
@@ -111,7 +167,7 @@ int cdb_findnext(struct cdb *c,const char *key,unsigned int len)
     c->kpos += 8;
     if (c->kpos == c->hpos + (c->hslots << 3)) c->kpos = c->hpos;
     uint32_unpack(buf,&u);
-    if (u == c->khash) {
+    if (u == ((c->version == 2) ? c->ktag : c->khash)) {
       if (cdb_read(c,buf,8,pos) == -1) return -1;
       uint32_unpack(buf,&u);
       if (u == len)
@@ -4,11 +4,20 @@
 #define CDB_H
 
 #include "uint32.h"
+#include "uint64.h"
 
 #define CDB_HASHSTART 5381
 extern uint32 cdb_hashadd(uint32,unsigned char);
 extern uint32 cdb_hash(const char *,unsigned int);
 
+/*
+cdb2: as cdb, but the 8 bytes at position 2048 are CDB2_MAGIC, records
+start at 2056, the hash is cdb_hash2(), and each hash slot holds the
+top 32 bits of the hash instead of the bottom 32.
+*/
+#define CDB2_MAGIC "cdb2\0\0\0\0"
+extern uint64 cdb_hash2(const char *,unsigned int);
+
 struct cdb {
   char *map; /* 0 if no map is available */
   int fd;
@@ -20,12 +29,15 @@ struct cdb {
   uint32 hslots; /* initialized if loop is nonzero */
   uint32 dpos; /* initialized if cdb_findnext() returns 1 */
   uint32 dlen; /* initialized if cdb_findnext() returns 1 */
+  uint32 ktag; /* cdb2; initialized if loop is nonzero */
+  int version; /* 2 for cdb2, otherwise 1 */
 } ;
 
 extern void cdb_free(struct cdb *);
 extern void cdb_init(struct cdb *,int fd);
 
 extern int cdb_read(struct cdb *,char *,unsigned int,uint32);
+extern char *cdb_getptr(struct cdb *,char *,unsigned int,uint32);
 
 extern void cdb_findstart(struct cdb *);
 extern int cdb_findnext(struct cdb *,const char *,unsigned int);
@@ -19,3 +19,30 @@ uint32 cdb_hash(const char *buf,unsigned int len)
   }
   return h;
 }
+
+/* 8 bytes per multiply; the byte loops compile to single loads */
+uint64 cdb_hash2(const char *buf,unsigned int len)
+{
+  uint64 h;
+  uint64 w;
+  unsigned int i;
+
+  h = 0x9e3779b97f4a7c15ULL ^ len;
+  while (len >= 8) {
+    w = 0;
+    for (i = 0;i < 8;++i)
+      w |= (uint64) (unsigned char) buf[i] << (8 * i);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+    buf += 8;
+    len -= 8;
+  }
+  w = 0;
+  for (i = 0;i < len;++i)
+    w |= (uint64) (unsigned char) buf[i] << (8 * i);
+  h = (h ^ w) * 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
@@ -1,5 +1,8 @@
 /* Public domain. */
 
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "seek.h"
 #include "error.h"
 #include "alloc.h"
@@ -13,6 +16,7 @@ int cdb_make_start(struct cdb_make *c,int fd)
   c->hash = 0;
   c->numentries = 0;
   c->fd = fd;
+  c->version = 1;
   c->pos = sizeof c->final;
   buffer_init(&c->b,buffer_unixwrite,fd,c->bspace,sizeof c->bspace);
   return seek_set(fd,c->pos);
@@ -26,7 +30,15 @@ static int posplus(struct cdb_make *c,uint32 len)
   return 0;
 }
 
-int cdb_make_addend(struct cdb_make *c,unsigned int keylen,unsigned int datalen,uint32 h)
+int cdb_make_start2(struct cdb_make *c,int fd)
+{
+  if (cdb_make_start(c,fd) == -1) return -1;
+  c->version = 2;
+  if (buffer_putalign(&c->b,CDB2_MAGIC,8) == -1) return -1;
+  return posplus(c,8);
+}
+
+static int addend(struct cdb_make *c,unsigned int keylen,unsigned int datalen,uint32 h,uint32 t)
 {
   struct cdb_hplist *head;
 
@@ -40,6 +52,7 @@ int cdb_make_addend(struct cdb_make *c,unsigned int keylen,unsigned int datalen,
   }
   head->hp[head->num].h = h;
   head->hp[head->num].p = c->pos;
+  head->hp[head->num].t = t;
   ++head->num;
   ++c->numentries;
   if (posplus(c,8) == -1) return -1;
@@ -48,6 +61,12 @@ int cdb_make_addend(struct cdb_make *c,unsigned int keylen,unsigned int datalen,
   return 0;
 }
 
+/* cdb only; cdb2 entries go through cdb_make_add() */
+int cdb_make_addend(struct cdb_make *c,unsigned int keylen,unsigned int datalen,uint32 h)
+{
+  return addend(c,keylen,datalen,h,0);
+}
+
 int cdb_make_addbegin(struct cdb_make *c,unsigned int keylen,unsigned int datalen)
 {
   char buf[8];
@@ -63,24 +82,103 @@ int cdb_make_addbegin(struct cdb_make *c,unsigned int keylen,unsigned int datale
 
 int cdb_make_add(struct cdb_make *c,const char *key,unsigned int keylen,const char *data,unsigned int datalen)
 {
+  uint64 h;
+
   if (cdb_make_addbegin(c,keylen,datalen) == -1) return -1;
   if (buffer_putalign(&c->b,key,keylen) == -1) return -1;
   if (buffer_putalign(&c->b,data,datalen) == -1) return -1;
+  if (c->version == 2) {
+    h = cdb_hash2(key,keylen);
+    return addend(c,keylen,datalen,h,h >> 32);
+  }
   return cdb_make_addend(c,keylen,datalen,cdb_hash(key,keylen));
 }
 
-int cdb_make_finish(struct cdb_make *c)
+static int putat(int fd,const char *buf,unsigned int len,uint32 pos)
 {
-  char buf[8];
+  int w;
+
+  while (len > 0) {
+    w = pwrite(fd,buf,len,pos);
+    if (w == -1) {
+      if (errno == error_intr) continue;
+      return -1;
+    }
+    buf += w;
+    len -= w;
+    pos += w;
+  }
+  return 0;
+}
+
+/* fill and write out the hash tables i with job[i] == j */
+static int tables(struct cdb_make *c,const unsigned char *job,unsigned int j)
+{
+  char buf[8192];
+  unsigned int buflen;
   int i;
+  uint32 pos;
   uint32 len;
   uint32 u;
-  uint32 memsize;
   uint32 count;
   uint32 where;
-  struct cdb_hplist *x;
   struct cdb_hp *hp;
 
+  for (i = 0;i < 256;++i) {
+    if (job[i] != j) continue;
+    count = c->count[i];
+
+    len = count + count; /* no overflow possible */
+    uint32_unpack(c->final + 8 * i,&pos);
+
+    for (u = 0;u < len;++u)
+      c->hash[u].h = c->hash[u].p = c->hash[u].t = 0;
+
+    hp = c->split + c->start[i];
+    for (u = 0;u < count;++u) {
+      where = (hp->h >> 8) % len;
+      while (c->hash[where].p)
+	if (++where == len)
+	  where = 0;
+      c->hash[where] = *hp++;
+    }
+
+    buflen = 0;
+    for (u = 0;u < len;++u) {
+      uint32_pack(buf + buflen,(c->version == 2) ? c->hash[u].t : c->hash[u].h);
+      uint32_pack(buf + buflen + 4,c->hash[u].p);
+      buflen += 8;
+      if ((buflen == sizeof buf) || (u + 1 == len)) {
+	if (putat(c->fd,buf,buflen,pos) == -1) return -1;
+	pos += buflen;
+	buflen = 0;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+Writes the 256 hash tables with n processes. Each table goes to a
+fixed position, so the result does not depend on n.
+*/
+int cdb_make_finishn(struct cdb_make *c,unsigned int n)
+{
+  unsigned char job[256];
+  pid_t pid[256];
+  int wstat;
+  int i;
+  int r;
+  unsigned int j;
+  uint32 len;
+  uint32 u;
+  uint32 memsize;
+  uint64 slots;
+  struct cdb_hplist *x;
+
+  if (n < 1) n = 1;
+  if (n > 256) n = 256;
+
   for (i = 0;i < 256;++i)
     c->count[i] = 0;
 
@@ -119,34 +217,37 @@ int cdb_make_finish(struct cdb_make *c)
       c->split[--c->start[255 & x->hp[i].h]] = x->hp[i];
   }
 
+  /* each job gets a run of tables with about 1/n of the slots */
+  slots = 0;
   for (i = 0;i < 256;++i) {
-    count = c->count[i];
-
-    len = count + count; /* no overflow possible */
+    len = c->count[i] + c->count[i];
     uint32_pack(c->final + 8 * i,c->pos);
     uint32_pack(c->final + 8 * i + 4,len);
+    if (len > 0x1fffffff) { errno = error_nomem; return -1; }
+    if (posplus(c,len << 3) == -1) return -1;
+    job[i] = (slots * n) / ((uint64) c->numentries * 2 + 1);
+    slots += len;
+  }
 
-    for (u = 0;u < len;++u)
-      c->hash[u].h = c->hash[u].p = 0;
-
-    hp = c->split + c->start[i];
-    for (u = 0;u < count;++u) {
-      where = (hp->h >> 8) % len;
-      while (c->hash[where].p)
-	if (++where == len)
-	  where = 0;
-      c->hash[where] = *hp++;
-    }
+  if (buffer_flush(&c->b) == -1) return -1;
 
-    for (u = 0;u < len;++u) {
-      uint32_pack(buf,c->hash[u].h);
-      uint32_pack(buf + 4,c->hash[u].p);
-      if (buffer_putalign(&c->b,buf,8) == -1) return -1;
-      if (posplus(c,8) == -1) return -1;
-    }
+  for (j = 1;j < n;++j) {
+    pid[j] = fork();
+    if (pid[j] == -1) return -1;
+    if (pid[j] == 0) _exit(tables(c,job,j) == -1 ? 111 : 0);
   }
+  r = tables(c,job,0);
+  for (j = 1;j < n;++j) {
+    if (waitpid(pid[j],&wstat,0) == -1) r = -1;
+    else if (!WIFEXITED(wstat) || WEXITSTATUS(wstat)) { errno = error_io; r = -1; }
+  }
+  if (r == -1) return -1;
 
-  if (buffer_flush(&c->b) == -1) return -1;
   if (seek_begin(c->fd) == -1) return -1;
   return buffer_putflush(&c->b,c->final,sizeof c->final);
 }
+
+int cdb_make_finish(struct cdb_make *c)
+{
+  return cdb_make_finishn(c,1);
+}
@@ -8,7 +8,7 @@
 
 #define CDB_HPLIST 1000
 
-struct cdb_hp { uint32 h; uint32 p; } ;
+struct cdb_hp { uint32 h; uint32 p; uint32 t; } ; /* t: cdb2 tag */
 
 struct cdb_hplist {
   struct cdb_hp hp[CDB_HPLIST];
@@ -28,12 +28,15 @@ struct cdb_make {
   buffer b;
   uint32 pos;
   int fd;
+  int version;
 } ;
 
 extern int cdb_make_start(struct cdb_make *,int);
+extern int cdb_make_start2(struct cdb_make *,int);
 extern int cdb_make_addbegin(struct cdb_make *,unsigned int,unsigned int);
 extern int cdb_make_addend(struct cdb_make *,unsigned int,unsigned int,uint32);
 extern int cdb_make_add(struct cdb_make *,const char *,unsigned int,const char *,unsigned int);
 extern int cdb_make_finish(struct cdb_make *);
+extern int cdb_make_finishn(struct cdb_make *,unsigned int);
 
 #endif
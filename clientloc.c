@@ -0,0 +1,224 @@
+#include "alloc.h"
+#include "byte.h"
+#include "error.h"
+#include "gen_alloc.h"
+#include "gen_allocdefs.h"
+#include "uint32.h"
+#include "cdb.h"
+#include "clientloc.h"
+
+/*
+clientloc_load() reads the location keys of a cdb: prefix followed by
+0 to 4 bytes of IP address, matching the first 8 bits per byte, or by
+4 bytes of IP address and a bit count. It turns them into a sorted list
+of address ranges, each with a location, so that clientloc_find() is a
+binary search. The answer is what cdb_find() on each key length,
+longest first, would give: the longest match wins, the first of two
+equal keys wins, and a match without 2 bytes of data gives no location.
+*/
+
+struct prefix {
+  uint32 lo;
+  uint32 hi;
+  uint32 order;
+  char loc[2];
+} ;
+
+GEN_ALLOC_typedef(prefix_alloc,struct prefix,s,len,a)
+GEN_ALLOC_readyplus(prefix_alloc,struct prefix,s,len,a,i,n,x,30,prefix_alloc_readyplus)
+GEN_ALLOC_append(prefix_alloc,struct prefix,s,len,a,i,n,x,30,prefix_alloc_readyplus,prefix_alloc_append)
+
+struct range {
+  uint32 start; /* runs up to the next start */
+  char loc[2];
+} ;
+
+GEN_ALLOC_typedef(range_alloc,struct range,s,len,a)
+GEN_ALLOC_readyplus(range_alloc,struct range,s,len,a,i,n,x,30,range_alloc_readyplus)
+GEN_ALLOC_append(range_alloc,struct range,s,len,a,i,n,x,30,range_alloc_readyplus,range_alloc_append)
+
+static prefix_alloc prefixes;
+static range_alloc ranges;
+
+static int parse(struct prefix *p,const char *x,unsigned int len)
+{
+  char ip[4];
+  unsigned int bits;
+  uint32 mask;
+
+  byte_zero(ip,4);
+  if (len <= 4) {
+    byte_copy(ip,len,x);
+    bits = 8 * len;
+  }
+  else {
+    byte_copy(ip,4,x);
+    bits = (unsigned char) x[4];
+    if (bits > 32) return 0;
+  }
+  mask = bits ? 0xffffffff << (32 - bits) : 0;
+  uint32_unpack_big(ip,&p->lo);
+  p->lo &= mask;
+  p->hi = p->lo | ~mask;
+  return 1;
+}
+
+static int diff(struct prefix *p,struct prefix *q)
+{
+  if (p->lo != q->lo) return (p->lo < q->lo) ? -1 : 1;
+  if (p->hi != q->hi) return (p->hi > q->hi) ? -1 : 1;
+  if (p->order != q->order) return (p->order < q->order) ? -1 : 1;
+  return 0;
+}
+
+static void sort(struct prefix *z,unsigned int n)
+{
+  unsigned int i;
+  unsigned int j;
+  unsigned int p;
+  unsigned int q;
+  struct prefix t;
+
+  i = j = n;
+  --z;
+
+  while (j > 1) {
+    if (i > 1) { --i; t = z[i]; }
+    else { t = z[j]; z[j] = z[i]; --j; }
+    q = i;
+    while ((p = q * 2) < j) {
+      if (diff(&z[p + 1],&z[p]) >= 0) ++p;
+      z[q] = z[p]; q = p;
+    }
+    if (p == j) {
+      z[q] = z[p]; q = p;
+    }
+    while ((q > i) && (diff(&t,&z[p = q/2]) > 0)) {
+      z[q] = z[p]; q = p;
+    }
+    z[q] = t;
+  }
+}
+
+/* from address a on, up to the next set(), the location is loc */
+static int set(uint32 a,const char loc[2])
+{
+  struct range *last;
+  struct range r;
+
+  last = ranges.s + ranges.len - 1;
+  if (last->start == a) {
+    byte_copy(last->loc,2,loc);
+    if ((ranges.len > 1) && byte_equal(last[-1].loc,2,loc)) --ranges.len;
+    return 1;
+  }
+  if (byte_equal(last->loc,2,loc)) return 1;
+  r.start = a;
+  byte_copy(r.loc,2,loc);
+  return range_alloc_append(&ranges,&r);
+}
+
+static int build(void)
+{
+  struct prefix *stack[33];
+  unsigned int sp;
+  struct prefix *p;
+  struct range r;
+  unsigned int i;
+
+  ranges.len = 0;
+  r.start = 0;
+  byte_zero(r.loc,2);
+  if (!range_alloc_append(&ranges,&r)) return 0;
+
+  sort(prefixes.s,prefixes.len);
+  sp = 0;
+  for (i = 0;i < prefixes.len;++i) {
+    p = prefixes.s + i;
+    while (sp && (stack[sp - 1]->hi < p->lo)) {
+      --sp;
+      if (!set(stack[sp]->hi + 1,sp ? stack[sp - 1]->loc : "\0\0")) return 0;
+    }
+    if (sp && (stack[sp - 1]->lo == p->lo) && (stack[sp - 1]->hi == p->hi))
+      continue;
+    if (!set(p->lo,p->loc)) return 0;
+    stack[sp++] = p;
+  }
+  while (sp) {
+    --sp;
+    if (stack[sp]->hi != 0xffffffff)
+      if (!set(stack[sp]->hi + 1,sp ? stack[sp - 1]->loc : "\0\0")) return 0;
+  }
+  return 1;
+}
+
+int clientloc_load(struct cdb *c,const char *pre,unsigned int prelen)
+{
+  char buf[64];
+  char *x;
+  uint32 eod;
+  uint32 pos;
+  uint32 klen;
+  uint32 dlen;
+  struct prefix p;
+
+  prefixes.len = 0;
+  x = cdb_getptr(c,buf,4,0);
+  if (!x) return 0;
+  uint32_unpack(x,&eod);
+  pos = 2048;
+  if (c->version == 2) pos += 8; /* CDB2_MAGIC */
+
+  while (pos < eod) {
+    if (eod - pos < 8) goto FORMAT;
+    x = cdb_getptr(c,buf,8,pos);
+    if (!x) return 0;
+    uint32_unpack(x,&klen);
+    uint32_unpack(x + 4,&dlen);
+    pos += 8;
+    if (eod - pos < klen) goto FORMAT;
+    if (eod - pos - klen < dlen) goto FORMAT;
+    if ((klen >= prelen) && (klen <= prelen + 5) && (klen <= sizeof buf)) {
+      x = cdb_getptr(c,buf,klen,pos);
+      if (!x) return 0;
+      if (byte_equal(x,prelen,pre))
+        if (parse(&p,x + prelen,klen - prelen)) {
+          byte_zero(p.loc,2);
+          if (dlen == 2) {
+            x = cdb_getptr(c,buf,2,pos + klen);
+            if (!x) return 0;
+            byte_copy(p.loc,2,x);
+          }
+          p.order = prefixes.len;
+          if (!prefix_alloc_append(&prefixes,&p)) return 0;
+        }
+    }
+    pos += klen + dlen;
+  }
+
+  return build();
+
+  FORMAT:
+  errno = error_proto;
+  return 0;
+}
+
+void clientloc_find(char loc[2],const char ip[4])
+{
+  uint32 u;
+  unsigned int lo;
+  unsigned int hi;
+  unsigned int mid;
+
+  byte_zero(loc,2);
+  if (!ranges.len) return;
+  uint32_unpack_big(ip,&u);
+  lo = 0;
+  hi = ranges.len;
+  while (hi - lo > 1) {
+    mid = lo + (hi - lo) / 2;
+    if (ranges.s[mid].start <= u) lo = mid;
+    else hi = mid;
+  }
+  byte_copy(loc,2,ranges.s[lo].loc);
+}
@@ -0,0 +1,9 @@
+#ifndef CLIENTLOC_H
+#define CLIENTLOC_H
+
+#include "cdb.h"
+
+extern int clientloc_load(struct cdb *,const char *,unsigned int);
+extern void clientloc_find(char *,const char *);
+
+#endif
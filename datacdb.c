@@ -0,0 +1,73 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "error.h"
+#include "open.h"
+#include "tai.h"
+#include "cdb.h"
+#include "datacdb.h"
+
+/*
+data.cdb stays open and mapped between queries. At most once a
+second, datacdb() compares it with the file now named data.cdb, and
+switches to that file if tinydns-data (or rbldns-data, pickdns-data)
+has renamed a new one into place.
+*/
+
+uint32 datacdb_generation = 0; /* changes with each switch */
+
+static struct cdb db;
+static int flagopen = 0;
+static struct stat cur;
+static struct tai checked;
+
+static int same(struct stat *st)
+{
+  return (st->st_ino == cur.st_ino) && (st->st_dev == cur.st_dev)
+    && (st->st_size == cur.st_size) && (st->st_mtime == cur.st_mtime);
+}
+
+static void reload(void)
+{
+  struct stat st;
+  int fd;
+
+  if (stat("data.cdb",&st) == -1) {
+    if (errno != error_noent) return; /* keep what we have */
+    if (flagopen) {
+      cdb_free(&db);
+      close(db.fd);
+      flagopen = 0;
+      ++datacdb_generation;
+    }
+    return;
+  }
+  if (flagopen && same(&st)) return;
+
+  fd = open_read("data.cdb");
+  if (fd == -1) return;
+  if (fstat(fd,&st) == -1) { close(fd); return; }
+  if (flagopen) {
+    cdb_free(&db);
+    close(db.fd);
+  }
+  cdb_init(&db,fd);
+  cur = st;
+  flagopen = 1;
+  ++datacdb_generation;
+}
+
+/* 1: c reads the current data.cdb; 0: there is none */
+int datacdb(struct cdb *c)
+{
+  struct tai now;
+
+  tai_now(&now);
+  if (!flagopen || tai_less(&checked,&now)) {
+    reload();
+    checked = now;
+  }
+  if (!flagopen) return 0;
+  *c = db;
+  return 1;
+}
@@ -0,0 +1,10 @@
+#ifndef DATACDB_H
+#define DATACDB_H
+
+#include "cdb.h"
+#include "uint32.h"
+
+extern uint32 datacdb_generation;
+extern int datacdb(struct cdb *);
+
+#endif
@@ -33,6 +33,15 @@ struct dns_transmit {
   unsigned int udploop;
   unsigned int curserver;
   struct taia deadline;
+  struct taia sent; /* last UDP query */
+  int flagdead; /* skip servers dns_rtt_dead() */
+  int flagsendto; /* UDP socket not connected; replies checked by source */
+  unsigned int uses; /* sends on s1, if it may be reused; 0 otherwise */
+  int flaghedge; /* may ask a second server */
+  int flaghedgeat; /* ask it at hedgeat */
+  struct taia hedgeat;
+  unsigned int hedged; /* 0, or 1 + first server, whose reply is still welcome */
+  struct taia hedgesent;
   unsigned int pos;
   const char *servers;
   char localip[4];
@@ -41,9 +50,18 @@ struct dns_transmit {
 
 extern void dns_random_init(const char *);
 extern unsigned int dns_random(unsigned int);
+extern void dns_random_worker(unsigned int);
 
 extern void dns_sortip(char *,unsigned int);
 
+extern void dns_rtt_sort(char *,unsigned int);
+extern void dns_rtt_sample(const char *,unsigned int);
+extern void dns_rtt_fail(const char *,const struct taia *,int);
+extern int dns_rtt_dead(const char *,const struct taia *);
+extern unsigned int dns_rtt_rto(const char *);
+extern uint64 dns_rtt_numdead;
+extern uint64 dns_rtt_numskipped;
+
 extern void dns_domain_free(char **);
 extern int dns_domain_copy(char **,const char *);
 extern unsigned int dns_domain_length(const char *);
@@ -57,6 +75,13 @@ extern unsigned int dns_packet_copy(const char *,unsigned int,unsigned int,char
 extern unsigned int dns_packet_getname(const char *,unsigned int,unsigned int,char **);
 extern unsigned int dns_packet_skipname(const char *,unsigned int,unsigned int);
 
+extern void dns_transmit_hedge(unsigned int);
+extern uint64 dns_transmit_numudp;
+extern uint64 dns_transmit_numhedges;
+extern void dns_transmit_reuse(unsigned int);
+extern void dns_transmit_rtt(int);
+extern void dns_transmit_skipdead(int);
+extern uint64 dns_transmit_numsockets;
 extern int dns_transmit_start(struct dns_transmit *,const char *,int,const char *,const char *,const char *);
 extern void dns_transmit_free(struct dns_transmit *);
 extern void dns_transmit_io(struct dns_transmit *,iopause_fd *,struct taia *);
@@ -49,6 +49,14 @@ void dns_random_init(const char data[128])
   /* more space in 10 and 11, but this is probably enough */
 }
 
+/* after fork: the worker's own sequence */
+void dns_random_worker(unsigned int worker)
+{
+  in[8] = getpid();
+  in[10] = worker;
+  outleft = 0;
+}
+
 unsigned int dns_random(unsigned int n)
 {
   if (!n) return 0;
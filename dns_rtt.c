@@ -0,0 +1,188 @@
+#include "byte.h"
+#include "uint32.h"
+#include "uint64.h"
+#include "taia.h"
+#include "dns.h"
+
+/*
+Round-trip times of the servers dns_transmit has talked to, in ms.
+srtt and rttvar are smoothed as in TCP; dns_rtt_rto() is srtt plus 4
+rttvar, and sets the first UDP timeout for the server. score orders
+the servers: a reply sets it to srtt, a timeout doubles it, and it
+shrinks by 1/64 each time dns_rtt_sort() puts a faster server first,
+so a server that was slow or dead gets another try now and then.
+Servers with no entry sort before all others, to be measured; ties
+keep the random order of dns_sortip().
+After DEADFAILS failures in a row that say unreachable, not just slow
+(an error, or no reply for the fixed first timeout of 1 second), a
+server is dead for DEADTTL seconds: dns_transmit skips it unless
+every server it has is dead. A shorter adaptive timeout only doubles
+the score.
+The table is direct-mapped; a new server replaces whatever was there.
+*/
+
+#define SLOTS 1024
+#define RTOMIN 50
+#define SCOREFAIL 200
+#define SCOREMAX 60000
+#define DEADFAILS 3
+#define DEADTTL 300
+
+uint64 dns_rtt_numdead = 0;
+uint64 dns_rtt_numskipped = 0;
+
+struct rtt {
+  char ip[4]; /* 0.0.0.0: empty */
+  uint32 srtt; /* 0: no reply yet */
+  uint32 rttvar;
+  uint32 score;
+  unsigned int fails; /* since the last reply */
+  struct taia dead; /* until then */
+} ;
+
+static struct rtt table[SLOTS];
+
+static struct rtt *slot(const char ip[4])
+{
+  uint32 h;
+
+  h = (unsigned char) ip[0];
+  h = (h << 8) + (unsigned char) ip[1];
+  h = (h << 8) + (unsigned char) ip[2];
+  h = (h << 8) + (unsigned char) ip[3];
+  h *= 0x9e3779b1;
+  return table + (h >> 22);
+}
+
+static struct rtt *find(const char ip[4])
+{
+  struct rtt *r;
+
+  r = slot(ip);
+  if (byte_diff(r->ip,4,ip)) return 0;
+  return r;
+}
+
+static struct rtt *make(const char ip[4])
+{
+  struct rtt *r;
+
+  r = slot(ip);
+  if (byte_diff(r->ip,4,ip)) {
+    byte_copy(r->ip,4,ip);
+    r->srtt = 0;
+    r->rttvar = 0;
+    r->score = 0;
+    r->fails = 0;
+    taia_uint(&r->dead,0);
+  }
+  return r;
+}
+
+void dns_rtt_sample(const char ip[4],unsigned int ms)
+{
+  struct rtt *r;
+  uint32 delta;
+
+  if (ms > SCOREMAX) ms = SCOREMAX;
+  r = make(ip);
+  if (!r->srtt) {
+    r->srtt = ms ? ms : 1;
+    r->rttvar = ms / 2;
+  }
+  else {
+    delta = (r->srtt > ms) ? r->srtt - ms : ms - r->srtt;
+    r->rttvar = (3 * r->rttvar + delta) / 4;
+    r->srtt = (7 * r->srtt + ms) / 8;
+    if (!r->srtt) r->srtt = 1;
+  }
+  r->score = r->srtt;
+  r->fails = 0;
+  taia_uint(&r->dead,0);
+}
+
+void dns_rtt_fail(const char ip[4],const struct taia *now,int flagunreachable)
+{
+  struct rtt *r;
+  struct taia t;
+
+  r = make(ip);
+  if (r->score < SCOREFAIL / 2) r->score = SCOREFAIL / 2;
+  r->score *= 2;
+  if (r->score > SCOREMAX) r->score = SCOREMAX;
+
+  if (!flagunreachable) return;
+  if (++r->fails == DEADFAILS) {
+    taia_uint(&t,DEADTTL);
+    taia_add(&r->dead,now,&t);
+    ++dns_rtt_numdead;
+  }
+}
+
+int dns_rtt_dead(const char ip[4],const struct taia *now)
+{
+  struct rtt *r;
+
+  r = find(ip);
+  if (!r) return 0;
+  if (r->fails < DEADFAILS) return 0;
+  if (!taia_less(now,&r->dead)) {
+    r->fails = DEADFAILS - 1; /* one more failure and it is dead again */
+    return 0;
+  }
+  return 1;
+}
+
+/* 0 if unknown */
+unsigned int dns_rtt_rto(const char ip[4])
+{
+  struct rtt *r;
+  uint32 rto;
+
+  r = find(ip);
+  if (!r || !r->srtt) return 0;
+  rto = r->srtt + 4 * r->rttvar;
+  if (rto < RTOMIN) rto = RTOMIN;
+  if (rto > SCOREMAX) rto = SCOREMAX;
+  return rto;
+}
+
+/* as dns_sortip(), then fastest first */
+void dns_rtt_sort(char *s,unsigned int n)
+{
+  uint32 key[16];
+  uint32 k;
+  struct rtt *r;
+  unsigned int i;
+  unsigned int j;
+  char tmp[4];
+
+  dns_sortip(s,n);
+  n >>= 2;
+  if (n > 16) n = 16;
+
+  for (i = 0;i < n;++i) {
+    if (byte_equal(s + 4 * i,4,"\0\0\0\0"))
+      key[i] = 0xffffffff;
+    else {
+      r = find(s + 4 * i);
+      key[i] = r ? r->score + 1 : 0; /* unmeasured first */
+    }
+  }
+
+  for (i = 1;i < n;++i) {
+    k = key[i];
+    byte_copy(tmp,4,s + 4 * i);
+    for (j = i;(j > 0) && (key[j - 1] > k);--j) {
+      key[j] = key[j - 1];
+      byte_copy(s + 4 * j,4,s + 4 * (j - 1));
+    }
+    key[j] = k;
+    byte_copy(s + 4 * j,4,tmp);
+  }
+
+  for (i = 1;i < n;++i) {
+    r = find(s + 4 * i);
+    if (r) r->score -= r->score >> 6;
+  }
+}
@@ -71,6 +71,7 @@ static void socketfree(struct dns_transmit *d)
   if (!d->s1) return;
   close(d->s1 - 1);
   d->s1 = 0;
+  d->uses = 0;
 }
 
 void dns_transmit_free(struct dns_transmit *d)
@@ -94,32 +95,188 @@ static int randombind(struct dns_transmit *d)
 
 static const int timeouts[4] = { 1, 3, 11, 45 };
 
+/*
+Hedging: a non-recursive query not answered within the server's rto
+(HEDGEDELAY ms if unknown) also goes to the next server, on the same
+unconnected socket, and the first relevant reply from either wins.
+At most hedgepercent hedges per 100 UDP queries.
+*/
+
+#define HEDGEDELAY 300
+
+static unsigned int hedgepercent = 0;
+uint64 dns_transmit_numudp = 0;
+uint64 dns_transmit_numhedges = 0;
+uint64 dns_transmit_numsockets = 0;
+
+void dns_transmit_hedge(unsigned int percent)
+{
+  if (percent > 100) percent = 100;
+  hedgepercent = percent;
+}
+
+/*
+Socket reuse: a non-recursive query keeps its UDP socket, bound to a
+random port, for up to reuses sends of the same question: retries
+and the other servers of the list. Each is one sendto() instead of
+socket(), bind(), connect(), send() and close(). Replies are matched
+by server, port 53, id and question. dns_transmit_start() always
+starts on a new port, and so does the next send once any server has
+replied on the old one: a server never learns a port it could use
+to attack another question. Off (0) by default.
+*/
+
+static unsigned int reuses = 0;
+
+void dns_transmit_reuse(unsigned int n)
+{
+  reuses = n;
+}
+
+/* with flagrtt, the first UDP timeout for a server is its dns_rtt_rto() */
+static int flagrtt = 0;
+
+void dns_transmit_rtt(int flag)
+{
+  flagrtt = flag;
+}
+
+/* with flagskipdead, servers dns_rtt_dead() are skipped while one is alive */
+static int flagskipdead = 0;
+
+void dns_transmit_skipdead(int flag)
+{
+  flagskipdead = flag;
+}
+
+static void msec(struct taia *t,const struct taia *from,unsigned long ms)
+{
+  struct taia u;
+
+  taia_uint(&u,ms / 1000);
+  u.nano = (ms % 1000) * 1000000;
+  taia_add(t,from,&u);
+}
+
+/* the server's rto, 4 times longer each round; at most the old timeout */
+static void udpdeadline(struct dns_transmit *d,const char *ip)
+{
+  unsigned long ms;
+
+  ms = 0;
+  if (flagrtt && !(d->query[4] & 1)) /* a recursive server may take long */
+    ms = dns_rtt_rto(ip);
+  ms <<= 2 * d->udploop;
+  if (d->flaghedge) ms <<= 2; /* the hedge comes first */
+  if (!ms || (ms >= 1000 * timeouts[d->udploop]))
+    ms = 1000 * timeouts[d->udploop];
+  msec(&d->deadline,&d->sent,ms);
+
+  d->flaghedgeat = 0;
+  if (d->flaghedge) {
+    ms = dns_rtt_rto(ip);
+    if (!ms) ms = HEDGEDELAY;
+    msec(&d->hedgeat,&d->sent,ms);
+    if (taia_less(&d->hedgeat,&d->deadline)) d->flaghedgeat = 1;
+  }
+}
+
+/* no reply for the fixed first timeout: maybe unreachable, not just slow */
+static int longwait(const struct taia *sent,const struct taia *when)
+{
+  struct taia t;
+
+  taia_uint(&t,timeouts[0]);
+  taia_add(&t,sent,&t);
+  return !taia_less(when,&t);
+}
+
+static void udpsample(const char *ip,const struct taia *sent,const struct taia *when)
+{
+  struct taia t;
+  double ms;
+
+  ms = 0;
+  if (!taia_less(when,sent)) {
+    taia_sub(&t,when,sent);
+    ms = taia_approx(&t) * 1000.0;
+  }
+  if (ms > 100000) ms = 100000;
+  dns_rtt_sample(ip,(unsigned int) ms);
+}
+
+/* keep waiting for curserver; ask the next server too */
+static void hedgeudp(struct dns_transmit *d,const struct taia *when)
+{
+  struct taia deadline;
+  const char *ip;
+  unsigned int j;
+
+  d->flaghedgeat = 0;
+  if (100 * (dns_transmit_numhedges + 1) > hedgepercent * dns_transmit_numudp) return;
+
+  for (j = d->curserver + 1;j < 16;++j) {
+    ip = d->servers + 4 * j;
+    if (byte_equal(ip,4,"\0\0\0\0")) continue;
+    if (d->flagdead && dns_rtt_dead(ip,when)) continue;
+    if (socket_send4(d->s1 - 1,d->query + 2,d->querylen - 2,ip,53) != d->querylen - 2) continue;
+    ++dns_transmit_numudp;
+    ++dns_transmit_numhedges;
+    d->hedged = 1 + d->curserver;
+    d->hedgesent = d->sent;
+    d->curserver = j;
+    d->sent = *when;
+    deadline = d->deadline;
+    udpdeadline(d,ip);
+    d->flaghedgeat = 0;
+    if (taia_less(&d->deadline,&deadline)) d->deadline = deadline;
+    return;
+  }
+}
+
 static int thisudp(struct dns_transmit *d)
 {
+  struct taia now;
   const char *ip;
+  int r;
 
-  socketfree(d);
+  if (!d->uses || (d->uses >= reuses)) socketfree(d);
+  taia_now(&now);
 
   while (d->udploop < 4) {
     for (;d->curserver < 16;++d->curserver) {
       ip = d->servers + 4 * d->curserver;
       if (byte_diff(ip,4,"\0\0\0\0")) {
+        if (d->flagdead && dns_rtt_dead(ip,&now)) {
+          ++dns_rtt_numskipped;
+          continue;
+        }
 	d->query[2] = dns_random(256);
 	d->query[3] = dns_random(256);
   
-        d->s1 = 1 + socket_udp();
-        if (!d->s1) { dns_transmit_free(d); return -1; }
-	if (randombind(d) == -1) { dns_transmit_free(d); return -1; }
-
-        if (socket_connect4(d->s1 - 1,ip,53) == 0)
-          if (send(d->s1 - 1,d->query + 2,d->querylen - 2,0) == d->querylen - 2) {
-            struct taia now;
-            taia_now(&now);
-            taia_uint(&d->deadline,timeouts[d->udploop]);
-            taia_add(&d->deadline,&d->deadline,&now);
-            d->tcpstate = 0;
-            return 0;
-          }
+        if (!d->s1) {
+          d->s1 = 1 + socket_udp();
+          if (!d->s1) { dns_transmit_free(d); return -1; }
+          if (randombind(d) == -1) { dns_transmit_free(d); return -1; }
+          ++dns_transmit_numsockets;
+        }
+
+        if (d->flagsendto)
+          r = socket_send4(d->s1 - 1,d->query + 2,d->querylen - 2,ip,53);
+        else {
+          r = -1;
+          if (socket_connect4(d->s1 - 1,ip,53) == 0)
+            r = send(d->s1 - 1,d->query + 2,d->querylen - 2,0);
+        }
+        if (r == d->querylen - 2) {
+          ++dns_transmit_numudp;
+          if (reuses && d->flagsendto) ++d->uses;
+          d->hedged = 0;
+          taia_now(&d->sent);
+          udpdeadline(d,ip);
+          d->tcpstate = 0;
+          return 0;
+        }
   
         socketfree(d);
       }
@@ -134,6 +291,21 @@ static int thisudp(struct dns_transmit *d)
 
 static int firstudp(struct dns_transmit *d)
 {
+  struct taia now;
+  const char *ip;
+  int j;
+
+  taia_now(&now);
+  d->flagdead = 0;
+  if (flagskipdead)
+    for (j = 0;j < 16;++j) {
+      ip = d->servers + 4 * j;
+      if (byte_diff(ip,4,"\0\0\0\0") && !dns_rtt_dead(ip,&now)) {
+        d->flagdead = 1; /* someone is alive */
+        break;
+      }
+    }
+
   d->curserver = 0;
   return thisudp(d);
 }
@@ -216,6 +388,10 @@ int dns_transmit_start(struct dns_transmit *d,const char servers[64],int flagrec
   byte_copy(d->localip,4,localip);
 
   d->udploop = flagrecursive ? 1 : 0;
+  d->flaghedge = hedgepercent && !flagrecursive;
+  d->flagsendto = d->flaghedge || (reuses && !flagrecursive);
+  d->flaghedgeat = 0;
+  d->hedged = 0;
 
   if (len + 16 > 512) return firsttcp(d);
   return firstudp(d);
@@ -236,12 +412,18 @@ void dns_transmit_io(struct dns_transmit *d,iopause_fd *x,struct taia *deadline)
 
   if (taia_less(&d->deadline,deadline))
     *deadline = d->deadline;
+  if (d->flaghedgeat && (d->tcpstate == 0))
+    if (taia_less(&d->hedgeat,deadline))
+      *deadline = d->hedgeat;
 }
 
 int dns_transmit_get(struct dns_transmit *d,const iopause_fd *x,const struct taia *when)
 {
   char udpbuf[513];
   unsigned char ch;
+  char ip[4];
+  uint16 port;
+  unsigned int from;
   int r;
   int fd;
 
@@ -249,9 +431,17 @@ int dns_transmit_get(struct dns_transmit *d,const iopause_fd *x,const struct tai
   fd = d->s1 - 1;
 
   if (!x->revents) {
+    if (d->flaghedgeat && (d->tcpstate == 0))
+      if (!taia_less(when,&d->hedgeat))
+        hedgeudp(d,when);
     if (taia_less(when,&d->deadline)) return 0;
     errno = error_timeout;
-    if (d->tcpstate == 0) return nextudp(d);
+    if (d->tcpstate == 0) {
+      dns_rtt_fail(d->servers + 4 * d->curserver,when,longwait(&d->sent,when));
+      if (d->hedged)
+        dns_rtt_fail(d->servers + 4 * (d->hedged - 1),when,longwait(&d->hedgesent,when));
+      return nextudp(d);
+    }
     return nexttcp(d);
   }
 
@@ -260,14 +450,39 @@ int dns_transmit_get(struct dns_transmit *d,const iopause_fd *x,const struct tai
 have attempted to send UDP query to each server udploop times
 have sent query to curserver on UDP socket s
 */
-    r = recv(fd,udpbuf,sizeof udpbuf,0);
+    if (d->flagsendto)
+      r = socket_recv4(fd,udpbuf,sizeof udpbuf,ip,&port);
+    else
+      r = recv(fd,udpbuf,sizeof udpbuf,0);
     if (r <= 0) {
       if (errno == error_connrefused) if (d->udploop == 2) return 0;
+      dns_rtt_fail(d->servers + 4 * d->curserver,when,1);
       return nextudp(d);
     }
     if (r + 1 > sizeof udpbuf) return 0;
 
+    from = d->curserver;
+    if (d->flagsendto) {
+      if (port != 53) return 0;
+      if (byte_diff(ip,4,d->servers + 4 * from)) {
+        if (!d->hedged) return 0;
+        from = d->hedged - 1;
+        if (byte_diff(ip,4,d->servers + 4 * from)) return 0;
+      }
+    }
+
     if (irrelevant(d,udpbuf,r)) return 0;
+    d->uses = 0; /* the port is known: no more sends on it */
+    if (from != d->curserver) {
+      udpsample(d->servers + 4 * from,&d->hedgesent,when);
+      if (serverfailed(udpbuf,r)) { d->hedged = 0; return 0; }
+      d->curserver = from; /* the reply came from here */
+    }
+    else {
+      udpsample(d->servers + 4 * from,&d->sent,when);
+      if (d->hedged) /* at least this slow */
+        udpsample(d->servers + 4 * (d->hedged - 1),&d->hedgesent,when);
+    }
     if (serverwantstcp(udpbuf,r)) return firsttcp(d);
     if (serverfailed(udpbuf,r)) {
       if (d->udploop == 2) return 0;
@@ -32,6 +32,7 @@ char *dir;
 char *user;
 char *loguser;
 struct passwd *pw;
+struct passwd *dnspw;
 const char *myip;
 
 uint32 seed[32];
@@ -85,6 +86,10 @@ int main(int argc,char **argv)
   seed_addtime();
   if (!pw)
     strerr_die3x(111,FATAL,"unknown account ",loguser);
+  dnspw = getpwnam(user);
+  seed_addtime();
+  if (!dnspw)
+    strerr_die3x(111,FATAL,"unknown account ",user);
 
   if (chdir(auto_home) == -1)
     strerr_die4sys(111,FATAL,"unable to switch to ",auto_home,": ");
@@ -120,6 +125,10 @@ int main(int argc,char **argv)
   seed_addtime(); perm(0644);
   seed_addtime(); start("env/DATALIMIT"); outs("3000000\n"); finish();
   seed_addtime(); perm(0644);
+  seed_addtime(); start("env/CACHEDUMP"); outs("dump/cache\n"); finish();
+  seed_addtime(); perm(0644);
+  seed_addtime(); start("env/DUMPINTERVAL"); outs("600\n"); finish();
+  seed_addtime(); perm(0644);
   seed_addtime(); start("run");
   outs("#!/bin/sh\nexec 2>&1\nexec <seed\nexec envdir ./env sh -c '\n  exec envuidgid "); outs(user);
   outs(" softlimit -o250 -d \"$DATALIMIT\" ");
@@ -135,6 +144,9 @@ int main(int argc,char **argv)
   seed_addtime(); perm(02755);
   seed_addtime(); start("root/ip/127.0.0.1"); finish();
   seed_addtime(); perm(0600);
+  seed_addtime(); makedir("root/dump");
+  seed_addtime(); owner(dnspw->pw_uid,dnspw->pw_gid);
+  seed_addtime(); perm(02755);
   seed_addtime(); makedir("root/servers");
   seed_addtime(); perm(02755);
   seed_addtime(); start("root/servers/@");
@@ -1,4 +1,8 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <unistd.h>
+#include <stdio.h>
 #include "env.h"
 #include "exit.h"
 #include "scan.h"
@@ -22,6 +26,12 @@
 #include "log.h"
 #include "okclient.h"
 #include "droproot.h"
+#include "workers.h"
+#include "event.h"
+#include "timer.h"
+#include "slots.h"
+#include "open.h"
+#include "stralloc.h"
 
 static int packetquery(char *buf,unsigned int len,char **q,char qtype[2],char qclass[2],char id[2])
 {
@@ -48,96 +58,382 @@ static int packetquery(char *buf,unsigned int len,char **q,char qtype[2],char qc
 
 static char myipoutgoing[4];
 static char myipincoming[4];
-static char buf[1024];
+static char buf[SOCKET_BATCH][1024];
 uint64 numqueries = 0;
+static unsigned int numworkers = 1;
+
+static uint64 newquery(void)
+{
+  uint64 result;
+
+  result = ++numqueries; /* query numbers are unique across workers */
+  numqueries += numworkers - 1;
+  return result;
+}
+
+
+static struct taia stamp;
+
+#define EV_UDP53 0
+#define EV_TCP53 1
+#define EV_U(j) (2 + 2 * (j))
+#define EV_T(j) (3 + 2 * (j))
+#define EV_SIGNAL 0xffffffff
+
+static int watch(int *fd,struct timer *tm,unsigned int data,iopause_fd *io,struct taia *deadline)
+{
+  int events;
+
+  if (io->fd != *fd) event_del(*fd,data);
+  *fd = io->fd;
+  events = 0;
+  if (io->events & IOPAUSE_READ) events |= EVENT_READ;
+  if (io->events & IOPAUSE_WRITE) events |= EVENT_WRITE;
+  if (event_set(*fd,events,data) == -1) return -1;
+  tm->data = data;
+  timer_set(tm,deadline);
+  return 0;
+}
+
+static void unwatch(int *fd,struct timer *tm,unsigned int data)
+{
+  event_del(*fd,data);
+  *fd = -1;
+  timer_clear(tm);
+}
 
 
 static int udp53;
 
-#define MAXUDP 200
+static unsigned int maxudp = 200;
+static struct slots uslots;
 static struct udpclient {
   struct query q;
-  struct taia start;
   uint64 active; /* query number, if active; otherwise 0 */
-  iopause_fd *io;
+  int fd; /* registered with event_set(), or -1 */
+  struct timer tm;
   char ip[4];
   uint16 port;
   char id[2];
-} u[MAXUDP];
+  int lead; /* 1 if in the in-flight table */
+  int follow; /* slot whose resolution answers this query, or -1 */
+  int followers; /* first slot following this one, or -1 */
+  int next; /* next slot in table chain or follower list, or -1 */
+  char name[256]; /* if lead or following */
+  char qtype[2];
+  char qclass[2];
+  int refresh; /* 1 if resolving only to refresh the cache */
+} *u;
 int uactive = 0;
 
+static unsigned int maxrefresh;
+static unsigned int urefresh = 0;
+
+/*
+In-flight table: a UDP query for a name, type, and class that some
+other UDP query is already resolving follows it instead of starting
+its own resolution, and gets a copy of its response.
+*/
+
+static int *ubucket;
+static unsigned int ubucketmask;
+
+static unsigned int u_hash(const char *q,const char qtype[2],const char qclass[2])
+{
+  unsigned int h;
+  unsigned int len;
+  unsigned char ch;
+
+  h = 5381;
+  len = dns_domain_length(q);
+  while (len) {
+    ch = *q++;
+    if ((ch >= 'A') && (ch <= 'Z')) ch += 32;
+    h = (h + (h << 5)) ^ ch;
+    --len;
+  }
+  h = (h + (h << 5)) ^ (unsigned char) qtype[0];
+  h = (h + (h << 5)) ^ (unsigned char) qtype[1];
+  h = (h + (h << 5)) ^ (unsigned char) qclass[0];
+  h = (h + (h << 5)) ^ (unsigned char) qclass[1];
+  return h & ubucketmask;
+}
+
+static int u_find(const char *q,const char qtype[2],const char qclass[2])
+{
+  int j;
+
+  for (j = ubucket[u_hash(q,qtype,qclass)];j != -1;j = u[j].next)
+    if (byte_equal(u[j].qtype,2,qtype))
+      if (byte_equal(u[j].qclass,2,qclass))
+        if (dns_domain_equal(u[j].name,q))
+          return j;
+  return -1;
+}
+
+static void u_lead(int j,const char *q,const char qtype[2],const char qclass[2])
+{
+  unsigned int h;
+
+  byte_copy(u[j].name,dns_domain_length(q),q);
+  byte_copy(u[j].qtype,2,qtype);
+  byte_copy(u[j].qclass,2,qclass);
+  h = u_hash(q,qtype,qclass);
+  u[j].next = ubucket[h];
+  ubucket[h] = j;
+  u[j].lead = 1;
+}
+
+static void u_follow(int j,int leader,const char *q)
+{
+  byte_copy(u[j].name,dns_domain_length(q),q);
+  u[j].follow = leader;
+  u[j].next = u[leader].followers;
+  u[leader].followers = j;
+}
+
+static void u_unlink(int j)
+{
+  int *p;
+
+  if (u[j].lead) {
+    p = &ubucket[u_hash(u[j].name,u[j].qtype,u[j].qclass)];
+    while (*p != j) p = &u[*p].next;
+    *p = u[j].next;
+    u[j].lead = 0;
+  }
+  if (u[j].follow != -1) {
+    p = &u[u[j].follow].followers;
+    while (*p != j) p = &u[*p].next;
+    *p = u[j].next;
+    u[j].follow = -1;
+  }
+}
+
+static struct socket_dgram in[SOCKET_BATCH];
+static char outbuf[SOCKET_BATCH][512];
+static struct socket_dgram out[SOCKET_BATCH];
+static unsigned int outnum = 0;
+
+uint64 numudprecv = 0;
+uint64 numudprecvcalls = 0;
+uint64 numudpsent = 0;
+uint64 numudpsendcalls = 0;
+
+static void u_flush(void)
+{
+  if (!outnum) return;
+  numudpsent += socket_sendmany4(udp53,out,outnum);
+  ++numudpsendcalls;
+  outnum = 0;
+}
+
+static void u_stop(int j)
+{
+  if (u[j].refresh) { u[j].refresh = 0; --urefresh; }
+  u[j].active = 0; --uactive;
+  slots_stop(&uslots,j);
+}
+
 void u_drop(int j)
 {
+  int f;
+
   if (!u[j].active) return;
+  u_unlink(j);
   log_querydrop(&u[j].active);
-  u[j].active = 0; --uactive;
+  u_stop(j);
+
+  while ((f = u[j].followers) != -1) {
+    u[j].followers = u[f].next;
+    u[f].follow = -1;
+    log_querydrop(&u[f].active);
+    u_stop(f);
+  }
+}
+
+static void u_send(int j)
+{
+  if (!u[j].refresh) {
+    if (outnum == SOCKET_BATCH) u_flush();
+    byte_copy(outbuf[outnum],response_len,response);
+    out[outnum].buf = outbuf[outnum];
+    out[outnum].len = response_len;
+    byte_copy(out[outnum].ip,4,u[j].ip);
+    out[outnum].port = u[j].port;
+    ++outnum;
+  }
+  log_querydone(&u[j].active,response_len);
+  u_stop(j);
 }
 
 void u_respond(int j)
 {
+  int f;
+
   if (!u[j].active) return;
+  u_unlink(j);
   response_id(u[j].id);
   if (response_len > 512) response_tc();
-  socket_send4(udp53,response,response_len,u[j].ip,u[j].port);
-  log_querydone(&u[j].active,response_len);
-  u[j].active = 0; --uactive;
+  u_send(j);
+
+  while ((f = u[j].followers) != -1) {
+    u[j].followers = u[f].next;
+    u[f].follow = -1;
+    response_id(u[f].id);
+    byte_copy(response + 12,dns_domain_length(u[f].name),u[f].name); /* 0x20 */
+    u_send(f);
+  }
 }
 
-void u_new(void)
+void u_watch(int j)
+{
+  iopause_fd io;
+  struct taia deadline;
+
+  if (u[j].active && (u[j].follow == -1)) {
+    taia_uint(&deadline,120);
+    taia_add(&deadline,&deadline,&stamp);
+    query_io(&u[j].q,&io,&deadline);
+    if (watch(&u[j].fd,&u[j].tm,EV_U(j),&io,&deadline) == 0) return;
+    u_drop(j);
+  }
+  unwatch(&u[j].fd,&u[j].tm,EV_U(j));
+}
+
+void u_io(int j,int revents)
+{
+  iopause_fd io;
+  int r;
+
+  if (!u[j].active) return;
+  if (u[j].follow != -1) return;
+  io.fd = u[j].fd;
+  io.revents = revents;
+  r = query_get(&u[j].q,&io,&stamp);
+  if (r == -1) u_drop(j);
+  if (r == 1) u_respond(j);
+  u_watch(j);
+}
+
+/*
+A cache hit on a popular entry near expiry sets cache_refresh. The
+name is then resolved again in a free UDP slot, with no client, to
+replace the entry before it expires. At most maxrefresh at a time;
+never by evicting a client; clients may evict refreshes.
+*/
+
+static void u_prefetch(char *q,char qtype[2],char qclass[2])
 {
   int j;
-  int i;
+
+  if (urefresh >= maxrefresh) return;
+  if (u_find(q,qtype,qclass) != -1) return;
+  j = slots_get(&uslots);
+  if (j == -1) return;
+
+  u[j].active = newquery(); ++uactive;
+  u[j].refresh = 1; ++urefresh;
+  slots_start(&uslots,j,&stamp);
+  u[j].followers = -1;
+  log_refresh(&u[j].active,q,qtype);
+
+  switch(query_refresh(&u[j].q,q,qtype,qclass,myipoutgoing)) {
+    case -1:
+      u_drop(j);
+      break;
+    case 1:
+      u_respond(j);
+      break;
+    default:
+      u_lead(j,q,qtype,qclass);
+  }
+  u_watch(j);
+}
+
+static void u_accept(int j,struct socket_dgram *d)
+{
   struct udpclient *x;
-  int len;
   static char *q = 0;
   char qtype[2];
   char qclass[2];
-
-  for (j = 0;j < MAXUDP;++j)
-    if (!u[j].active)
-      break;
-
-  if (j >= MAXUDP) {
-    j = 0;
-    for (i = 1;i < MAXUDP;++i)
-      if (taia_less(&u[i].start,&u[j].start))
-	j = i;
-    errno = error_timeout;
-    u_drop(j);
-  }
+  int leader;
 
   x = u + j;
-  taia_now(&x->start);
+  byte_copy(x->ip,4,d->ip);
+  x->port = d->port;
 
-  len = socket_recv4(udp53,buf,sizeof buf,x->ip,&x->port);
-  if (len == -1) return;
-  if (len >= sizeof buf) return;
-  if (x->port < 1024) if (x->port != 53) return;
-  if (!okclient(x->ip)) return;
+  if (d->len >= sizeof buf[0]) { slots_put(&uslots,j); return; }
+  if (x->port < 1024) if (x->port != 53) { slots_put(&uslots,j); return; }
+  if (!okclient(x->ip)) { slots_put(&uslots,j); return; }
 
-  if (!packetquery(buf,len,&q,qtype,qclass,x->id)) return;
+  if (!packetquery(d->buf,d->len,&q,qtype,qclass,x->id)) { slots_put(&uslots,j); return; }
 
-  x->active = ++numqueries; ++uactive;
+  x->active = newquery(); ++uactive;
+  slots_start(&uslots,j,&stamp);
+  x->followers = -1;
   log_query(&x->active,x->ip,x->port,x->id,q,qtype);
+
+  leader = u_find(q,qtype,qclass);
+  if (leader != -1) {
+    u_follow(j,leader,q);
+    return;
+  }
+
+  cache_refresh = 0;
   switch(query_start(&x->q,q,qtype,qclass,myipoutgoing)) {
     case -1:
       u_drop(j);
       return;
     case 1:
       u_respond(j);
+      if (cache_refresh) u_prefetch(q,qtype,qclass);
+      return;
   }
+  u_lead(j,q,qtype,qclass);
 }
 
+void u_new(void)
+{
+  int n;
+  int i;
+  int j;
+
+  for (i = 0;i < SOCKET_BATCH;++i) {
+    in[i].buf = buf[i];
+    in[i].len = sizeof buf[i];
+  }
+  n = socket_recvmany4(udp53,in,SOCKET_BATCH);
+  if (n <= 0) return;
+  numudprecv += n;
+  ++numudprecvcalls;
+
+  for (i = 0;i < n;++i) {
+    j = slots_get(&uslots);
+    if (j == -1) {
+      j = slots_oldest(&uslots);
+      if (u[j].followers != -1) j = u[j].followers; /* keep resolving */
+      errno = error_timeout;
+      u_drop(j);
+      u_watch(j);
+      j = slots_get(&uslots);
+    }
+
+    u_accept(j,in + i);
+    u_watch(j);
+  }
+}
 
 static int tcp53;
 
-#define MAXTCP 20
-struct tcpclient {
+static unsigned int maxtcp = 20;
+static struct slots tslots;
+static struct tcpclient {
   struct query q;
-  struct taia start;
   struct taia timeout;
   uint64 active; /* query number or 1, if active; otherwise 0 */
-  iopause_fd *io;
+  int fd; /* registered with event_set(), or -1 */
+  struct timer tm;
   char ip[4]; /* send response to this address */
   uint16 port; /* send response to this port */
   char id[2];
@@ -146,7 +442,7 @@ struct tcpclient {
   char *buf; /* 0, or dynamically allocated of length len */
   unsigned int len;
   unsigned int pos;
-} t[MAXTCP];
+} *t;
 int tactive = 0;
 
 /*
@@ -166,11 +462,9 @@ void t_free(int j)
 
 void t_timeout(int j)
 {
-  struct taia now;
   if (!t[j].active) return;
-  taia_now(&now);
   taia_uint(&t[j].timeout,10);
-  taia_add(&t[j].timeout,&t[j].timeout,&now);
+  taia_add(&t[j].timeout,&t[j].timeout,&stamp);
 }
 
 void t_close(int j)
@@ -180,6 +474,7 @@ void t_close(int j)
   log_tcpclose(t[j].ip,t[j].port);
   close(t[j].tcp);
   t[j].active = 0; --tactive;
+  slots_stop(&tslots,j);
 }
 
 void t_drop(int j)
@@ -252,133 +547,247 @@ void t_rw(int j)
 
   if (!packetquery(x->buf,x->len,&q,qtype,qclass,x->id)) { t_close(j); return; }
 
-  x->active = ++numqueries;
+  x->active = newquery();
   log_query(&x->active,x->ip,x->port,x->id,q,qtype);
+  cache_refresh = 0;
   switch(query_start(&x->q,q,qtype,qclass,myipoutgoing)) {
     case -1:
       t_drop(j);
       return;
     case 1:
       t_respond(j);
+      if (cache_refresh) u_prefetch(q,qtype,qclass);
       return;
   }
   t_free(j);
   x->state = 0;
 }
 
-void t_new(void)
+void t_watch(int j)
 {
-  int i;
-  int j;
-  struct tcpclient *x;
-
-  for (j = 0;j < MAXTCP;++j)
-    if (!t[j].active)
-      break;
+  iopause_fd io;
+  struct taia deadline;
 
-  if (j >= MAXTCP) {
-    j = 0;
-    for (i = 1;i < MAXTCP;++i)
-      if (taia_less(&t[i].start,&t[j].start))
-	j = i;
-    errno = error_timeout;
+  if (t[j].active) {
+    taia_uint(&deadline,120);
+    taia_add(&deadline,&deadline,&stamp);
     if (t[j].state == 0)
-      t_drop(j);
-    else
-      t_close(j);
+      query_io(&t[j].q,&io,&deadline);
+    else {
+      if (taia_less(&t[j].timeout,&deadline)) deadline = t[j].timeout;
+      io.fd = t[j].tcp;
+      io.events = (t[j].state > 0) ? IOPAUSE_READ : IOPAUSE_WRITE;
+    }
+    if (watch(&t[j].fd,&t[j].tm,EV_T(j),&io,&deadline) == 0) return;
+    if (t[j].state == 0) t_drop(j); else t_close(j);
   }
+  unwatch(&t[j].fd,&t[j].tm,EV_T(j));
+}
+
+void t_io(int j,int revents)
+{
+  iopause_fd io;
+  int r;
+
+  if (!t[j].active) return;
+  if (revents)
+    t_timeout(j);
+  if (t[j].state == 0) {
+    io.fd = t[j].fd;
+    io.revents = revents;
+    r = query_get(&t[j].q,&io,&stamp);
+    if (r == -1) t_drop(j);
+    if (r == 1) t_respond(j);
+  }
+  else
+    if (revents || taia_less(&t[j].timeout,&stamp))
+      t_rw(j);
+  t_watch(j);
+}
+
+static void t_accept(int j)
+{
+  struct tcpclient *x;
 
   x = t + j;
-  taia_now(&x->start);
 
   x->tcp = socket_accept4(tcp53,x->ip,&x->port);
-  if (x->tcp == -1) return;
-  if (x->port < 1024) if (x->port != 53) { close(x->tcp); return; }
-  if (!okclient(x->ip)) { close(x->tcp); return; }
-  if (ndelay_on(x->tcp) == -1) { close(x->tcp); return; } /* Linux bug */
+  if (x->tcp == -1) { slots_put(&tslots,j); return; }
+  if (x->port < 1024) if (x->port != 53) { close(x->tcp); slots_put(&tslots,j); return; }
+  if (!okclient(x->ip)) { close(x->tcp); slots_put(&tslots,j); return; }
+  if (ndelay_on(x->tcp) == -1) { close(x->tcp); slots_put(&tslots,j); return; } /* Linux bug */
 
   x->active = 1; ++tactive;
+  slots_start(&tslots,j,&stamp);
   x->state = 1;
   t_timeout(j);
 
   log_tcpopen(x->ip,x->port);
 }
 
+void t_new(void)
+{
+  int j;
+
+  j = slots_get(&tslots);
+  if (j == -1) {
+    j = slots_oldest(&tslots);
+    errno = error_timeout;
+    if (t[j].state == 0)
+      t_drop(j);
+    else
+      t_close(j);
+    t_watch(j);
+    j = slots_get(&tslots);
+  }
+
+  t_accept(j);
+  t_watch(j);
+}
+
+
+static stralloc dumpfn = {0}; /* $CACHEDUMP, plus .worker if $WORKERS > 1 */
+static stralloc dumptmp = {0};
+static unsigned long dumpinterval = 0;
+static struct timer dumptimer;
+static pid_t dumppid = 0;
+static int flagterm = 0;
+static int flagusr1 = 0;
+static int selfpipe[2]; /* a signal wakes event_wait() */
+
+static void wakeup(void)
+{
+  int e;
+
+  e = errno;
+  write(selfpipe[1],"",1);
+  errno = e;
+}
+
+static void drain(void)
+{
+  char ch[64];
+
+  while (read(selfpipe[0],ch,sizeof ch) > 0) ;
+}
+
+static void sigterm(int sig)
+{
+  flagterm = 1;
+  wakeup();
+}
+
+static void sigusr1(int sig)
+{
+  flagusr1 = 1;
+  wakeup();
+}
+
+static void catch(int sig,void (*f)(int))
+{
+  struct sigaction sa;
+
+  byte_zero(&sa,sizeof sa);
+  sa.sa_handler = f;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0;
+  sigaction(sig,&sa,(struct sigaction *) 0);
+}
+
+static void dump(void)
+{
+  int fd;
+
+  fd = open_trunc(dumptmp.s);
+  if (fd == -1) return;
+  if (cache_dump(fd) == -1) { close(fd); return; }
+  if (fsync(fd) == -1) { close(fd); return; }
+  if (close(fd) == -1) return;
+  rename(dumptmp.s,dumpfn.s);
+}
+
+static void dump_background(void)
+{
+  struct taia deadline;
+  int wstat;
+
+  if (dumppid)
+    if (waitpid(dumppid,&wstat,WNOHANG) != 0)
+      dumppid = 0;
+  if (!dumppid) {
+    dumppid = fork(); /* the child writes a copy-on-write snapshot */
+    if (dumppid == 0) { dump(); _exit(0); }
+    if (dumppid == -1) dumppid = 0;
+  }
+
+  taia_uint(&deadline,dumpinterval);
+  taia_add(&deadline,&deadline,&stamp);
+  timer_set(&dumptimer,&deadline);
+}
+
+static void dump_exit(void)
+{
+  int wstat;
 
-iopause_fd io[3 + MAXUDP + MAXTCP];
-iopause_fd *udp53io;
-iopause_fd *tcp53io;
+  if (dumppid) {
+    kill(dumppid,SIGKILL);
+    waitpid(dumppid,&wstat,0);
+  }
+  dump();
+  _exit(0);
+}
 
 static void doit(void)
 {
-  int j;
+  struct event ready[64];
   struct taia deadline;
-  struct taia stamp;
-  int iolen;
-  int r;
+  struct tai now;
+  struct timer *tm;
+  unsigned int data;
+  int flagudp;
+  int flagtcp;
+  int n;
+  int i;
 
+  taia_now(&stamp);
   for (;;) {
-    taia_now(&stamp);
+    if (flagterm) dump_exit();
+    if (flagusr1) {
+      flagusr1 = 0;
+      log_cachestats();
+    }
+
+    /* stamp is from the last wakeup: the wait may run long by its work */
     taia_uint(&deadline,120);
     taia_add(&deadline,&deadline,&stamp);
+    timer_next(&deadline);
+
+    n = event_wait(ready,sizeof ready / sizeof ready[0],&deadline,&stamp);
+    taia_now(&stamp);
+    taia_tai(&stamp,&now);
+    cache_clock(&now); /* one clock read per wakeup */
+
+    flagudp = flagtcp = 0;
+    for (i = 0;i < n;++i) {
+      data = ready[i].data;
+      if (data == EV_SIGNAL) drain();
+      else if (data == EV_UDP53) flagudp = 1;
+      else if (data == EV_TCP53) flagtcp = 1;
+      else if (data & 1) t_io((data - 3) / 2,ready[i].revents);
+      else u_io((data - 2) / 2,ready[i].revents);
+    }
+
+    while (tm = timer_expired(&stamp)) {
+      if (tm == &dumptimer) { dump_background(); continue; }
+      data = tm->data;
+      if (data & 1) t_io((data - 3) / 2,0);
+      else u_io((data - 2) / 2,0);
+    }
 
-    iolen = 0;
-
-    udp53io = io + iolen++;
-    udp53io->fd = udp53;
-    udp53io->events = IOPAUSE_READ;
-
-    tcp53io = io + iolen++;
-    tcp53io->fd = tcp53;
-    tcp53io->events = IOPAUSE_READ;
-
-    for (j = 0;j < MAXUDP;++j)
-      if (u[j].active) {
-	u[j].io = io + iolen++;
-	query_io(&u[j].q,u[j].io,&deadline);
-      }
-    for (j = 0;j < MAXTCP;++j)
-      if (t[j].active) {
-	t[j].io = io + iolen++;
-	if (t[j].state == 0)
-	  query_io(&t[j].q,t[j].io,&deadline);
-	else {
-	  if (taia_less(&t[j].timeout,&deadline)) deadline = t[j].timeout;
-	  t[j].io->fd = t[j].tcp;
-	  t[j].io->events = (t[j].state > 0) ? IOPAUSE_READ : IOPAUSE_WRITE;
-	}
-      }
-
-    iopause(io,iolen,&deadline,&stamp);
-
-    for (j = 0;j < MAXUDP;++j)
-      if (u[j].active) {
-	r = query_get(&u[j].q,u[j].io,&stamp);
-	if (r == -1) u_drop(j);
-	if (r == 1) u_respond(j);
-      }
-
-    for (j = 0;j < MAXTCP;++j)
-      if (t[j].active) {
-	if (t[j].io->revents)
-	  t_timeout(j);
-	if (t[j].state == 0) {
-	  r = query_get(&t[j].q,t[j].io,&stamp);
-	  if (r == -1) t_drop(j);
-	  if (r == 1) t_respond(j);
-	}
-	else
-	  if (t[j].io->revents || taia_less(&t[j].timeout,&stamp))
-	    t_rw(j);
-      }
-
-    if (udp53io)
-      if (udp53io->revents)
-	u_new();
-
-    if (tcp53io)
-      if (tcp53io->revents)
-	t_new();
+    /* new clients last: they may evict slots with events pending above */
+    if (flagudp) u_new();
+    if (flagtcp) t_new();
+    u_flush();
   }
 }
   
@@ -386,10 +795,25 @@ static void doit(void)
 
 char seed[128];
 
+static void nomem(void)
+{
+  strerr_die2x(111,FATAL,"out of memory");
+}
+
+static int udp53s[WORKERS_MAX];
+static int tcp53s[WORKERS_MAX];
+
 int main()
 {
   char *x;
   unsigned long cachesize;
+  unsigned long workers;
+  unsigned long max;
+  unsigned long refreshhits;
+  unsigned long refreshpercent;
+  unsigned int w;
+  unsigned int worker;
+  int fd;
 
   x = env_get("IP");
   if (!x)
@@ -397,25 +821,31 @@ int main()
   if (!ip4_scan(x,myipincoming))
     strerr_die3x(111,FATAL,"unable to parse IP address ",x);
 
-  udp53 = socket_udp();
-  if (udp53 == -1)
-    strerr_die2sys(111,FATAL,"unable to create UDP socket: ");
-  if (socket_bind4_reuse(udp53,myipincoming,53) == -1)
-    strerr_die2sys(111,FATAL,"unable to bind UDP socket: ");
-
-  tcp53 = socket_tcp();
-  if (tcp53 == -1)
-    strerr_die2sys(111,FATAL,"unable to create TCP socket: ");
-  if (socket_bind4_reuse(tcp53,myipincoming,53) == -1)
-    strerr_die2sys(111,FATAL,"unable to bind TCP socket: ");
+  workers = 1;
+  x = env_get("WORKERS");
+  if (x) scan_ulong(x,&workers);
+  if (workers < 1) workers = 1;
+  if (workers > WORKERS_MAX) workers = WORKERS_MAX;
+  numworkers = workers;
+
+  for (w = 0;w < numworkers;++w) {
+    udp53s[w] = socket_udp();
+    if (udp53s[w] == -1)
+      strerr_die2sys(111,FATAL,"unable to create UDP socket: ");
+    if (((numworkers > 1) ? socket_bind4_reuseport(udp53s[w],myipincoming,53) : socket_bind4_reuse(udp53s[w],myipincoming,53)) == -1)
+      strerr_die2sys(111,FATAL,"unable to bind UDP socket: ");
+
+    tcp53s[w] = socket_tcp();
+    if (tcp53s[w] == -1)
+      strerr_die2sys(111,FATAL,"unable to create TCP socket: ");
+    if (((numworkers > 1) ? socket_bind4_reuseport(tcp53s[w],myipincoming,53) : socket_bind4_reuse(tcp53s[w],myipincoming,53)) == -1)
+      strerr_die2sys(111,FATAL,"unable to bind TCP socket: ");
+  }
 
   droproot(FATAL);
 
-  socket_tryreservein(udp53,131072);
-
   byte_zero(seed,sizeof seed);
   read(0,seed,sizeof seed);
-  dns_random_init(seed);
   close(0);
 
   x = env_get("IPSEND");
@@ -424,13 +854,6 @@ int main()
   if (!ip4_scan(x,myipoutgoing))
     strerr_die3x(111,FATAL,"unable to parse IP address ",x);
 
-  x = env_get("CACHESIZE");
-  if (!x)
-    strerr_die2x(111,FATAL,"$CACHESIZE not set");
-  scan_ulong(x,&cachesize);
-  if (!cache_init(cachesize))
-    strerr_die3x(111,FATAL,"not enough memory for cache of size ",x);
-
   if (env_get("HIDETTL"))
     response_hidettl();
   if (env_get("FORWARDONLY"))
@@ -439,9 +862,139 @@ int main()
   if (!roots_init())
     strerr_die2sys(111,FATAL,"unable to read servers: ");
 
+  x = env_get("MAXUDP");
+  if (x) {
+    scan_ulong(x,&max);
+    if (max < 1) max = 1;
+    if (max > 100000) max = 100000;
+    maxudp = max;
+  }
+  x = env_get("MAXTCP");
+  if (x) {
+    scan_ulong(x,&max);
+    if (max < 1) max = 1;
+    if (max > 100000) max = 100000;
+    maxtcp = max;
+  }
+
+  maxrefresh = (maxudp + 9) / 10;
+  x = env_get("MAXREFRESH");
+  if (x) {
+    scan_ulong(x,&max);
+    if (max > maxudp) max = maxudp;
+    maxrefresh = max;
+  }
+  refreshhits = 10;
+  x = env_get("REFRESHHITS");
+  if (x) scan_ulong(x,&refreshhits);
+  refreshpercent = 10;
+  x = env_get("REFRESHPERCENT");
+  if (x) scan_ulong(x,&refreshpercent);
+  if (maxrefresh && refreshhits)
+    cache_refreshat(refreshhits,refreshpercent);
+
+  dns_transmit_rtt(1);
+  dns_transmit_skipdead(1);
+  x = env_get("UDPREUSE");
+  if (x) {
+    scan_ulong(x,&max);
+    dns_transmit_reuse(max);
+  }
+  x = env_get("HEDGEPERCENT");
+  if (x) {
+    scan_ulong(x,&max);
+    dns_transmit_hedge(max);
+  }
+
+  x = env_get("DUMPINTERVAL");
+  if (x) scan_ulong(x,&dumpinterval);
+
+  x = env_get("CACHESIZE");
+  if (!x)
+    strerr_die2x(111,FATAL,"$CACHESIZE not set");
+  scan_ulong(x,&cachesize);
+
+  worker = workers_start(numworkers,FATAL);
+  numqueries = worker;
+  udp53 = udp53s[worker];
+  tcp53 = tcp53s[worker];
+  for (w = 0;w < numworkers;++w)
+    if (udp53s[w] != udp53) {
+      close(udp53s[w]);
+      close(tcp53s[w]);
+    }
+
+  socket_tryreservein(udp53,131072);
+
+  dns_random_init(seed);
+
+  /* each worker caches privately; $CACHESIZE bounds the total */
+  if (!cache_init(cachesize / numworkers))
+    strerr_die3x(111,FATAL,"not enough memory for cache of size ",x);
+
+  x = env_get("CACHEDUMP");
+  if (x) {
+    if (!stralloc_copys(&dumpfn,x)) nomem();
+    if (numworkers > 1) {
+      if (!stralloc_cats(&dumpfn,".")) nomem();
+      if (!stralloc_catulong0(&dumpfn,worker,0)) nomem();
+    }
+    if (!stralloc_copy(&dumptmp,&dumpfn)) nomem();
+    if (!stralloc_cats(&dumptmp,".tmp")) nomem();
+    if (!stralloc_0(&dumpfn)) nomem();
+    if (!stralloc_0(&dumptmp)) nomem();
+  }
+  if (dumpfn.s) {
+    fd = open_read(dumpfn.s);
+    if (fd != -1) {
+      cache_load(fd); /* a damaged dump loads less; another format, nothing */
+      close(fd);
+    }
+  }
+
   if (socket_listen(tcp53,20) == -1)
     strerr_die2sys(111,FATAL,"unable to listen on TCP socket: ");
 
+  u = (struct udpclient *) alloc(maxudp * sizeof(struct udpclient));
+  if (!u || !slots_init(&uslots,maxudp))
+    strerr_die2x(111,FATAL,"not enough memory for $MAXUDP clients");
+  t = (struct tcpclient *) alloc(maxtcp * sizeof(struct tcpclient));
+  if (!t || !slots_init(&tslots,maxtcp))
+    strerr_die2x(111,FATAL,"not enough memory for $MAXTCP clients");
+  byte_zero(u,maxudp * sizeof(struct udpclient));
+  byte_zero(t,maxtcp * sizeof(struct tcpclient));
+  for (w = 0;w < maxudp;++w) {
+    u[w].fd = -1;
+    u[w].follow = -1;
+  }
+  for (ubucketmask = 1;ubucketmask < maxudp;ubucketmask <<= 1) ;
+  ubucket = (int *) alloc(ubucketmask * sizeof(int));
+  if (!ubucket)
+    strerr_die2x(111,FATAL,"not enough memory for $MAXUDP clients");
+  for (w = 0;w < ubucketmask;++w) ubucket[w] = -1;
+  --ubucketmask;
+  for (w = 0;w < maxtcp;++w) t[w].fd = -1;
+  event_init();
+  if (event_set(udp53,EVENT_READ,EV_UDP53) == -1)
+    strerr_die2sys(111,FATAL,"unable to watch UDP socket: ");
+  if (event_set(tcp53,EVENT_READ,EV_TCP53) == -1)
+    strerr_die2sys(111,FATAL,"unable to watch TCP socket: ");
+  if (pipe(selfpipe) == -1)
+    strerr_die2sys(111,FATAL,"unable to create pipe: ");
+  ndelay_on(selfpipe[0]);
+  ndelay_on(selfpipe[1]);
+  if (event_set(selfpipe[0],EVENT_READ,EV_SIGNAL) == -1)
+    strerr_die2sys(111,FATAL,"unable to watch pipe: ");
+
+  catch(SIGUSR1,sigusr1);
+  if (dumpfn.s) {
+    catch(SIGTERM,sigterm);
+    if (dumpinterval) {
+      taia_now(&stamp);
+      dump_background();
+    }
+  }
+
   log_startup();
   doit();
 }
@@ -0,0 +1,188 @@
+#include <unistd.h>
+#include "hasepoll.h"
+#ifdef HASEPOLL
+#include <sys/epoll.h>
+#endif
+#include "alloc.h"
+#include "byte.h"
+#include "error.h"
+#include "iopause.h"
+#include "event.h"
+
+/*
+Interest stays registered between calls, so with epoll a wakeup
+costs O(ready descriptors); callers re-register only what they touched.
+Without epoll, the registered descriptors are kept in a compact
+iopause_fd array and each wakeup is one iopause() over that array.
+*/
+
+struct fdstate {
+  int events; /* 0 if not registered */
+  unsigned int data;
+  unsigned int pos; /* 1 + index in io[], without epoll */
+} ;
+
+static struct fdstate *fds = 0;
+static unsigned int fdslen = 0;
+
+static iopause_fd *io = 0;
+static unsigned int ionum = 0;
+static unsigned int iolen = 0;
+
+static int epfd = -1;
+
+void event_init(void)
+{
+#ifdef HASEPOLL
+  epfd = epoll_create(1024); /* -1: fall back to iopause() */
+#endif
+}
+
+static int grow(int fd)
+{
+  unsigned int newlen;
+  unsigned int i;
+
+  if (fd < fdslen) return 1;
+  newlen = fdslen + 64;
+  while (newlen <= fd) newlen += newlen >> 1;
+  if (!alloc_re(&fds,fdslen * sizeof(struct fdstate),newlen * sizeof(struct fdstate)))
+    return 0;
+  for (i = fdslen;i < newlen;++i) fds[i].events = 0;
+  fdslen = newlen;
+  return 1;
+}
+
+#ifdef HASEPOLL
+static int epollctl(int op,int fd,int events,unsigned int data)
+{
+  struct epoll_event ev;
+
+  ev.events = 0;
+  if (events & EVENT_READ) ev.events |= EPOLLIN;
+  if (events & EVENT_WRITE) ev.events |= EPOLLOUT;
+  ev.data.u64 = data;
+  return epoll_ctl(epfd,op,fd,&ev);
+}
+#endif
+
+int event_set(int fd,int events,unsigned int data)
+{
+  struct fdstate *s;
+
+  if (fd < 0) return 0;
+  if (!events) { event_del(fd,data); return 0; }
+  if (!grow(fd)) return -1;
+  s = fds + fd;
+
+#ifdef HASEPOLL
+  if (epfd != -1) {
+    /* always tell the kernel: fd may have been closed and reopened */
+    if (s->events) {
+      if (epollctl(EPOLL_CTL_MOD,fd,events,data) == -1) {
+        if (errno != error_noent) return -1;
+        if (epollctl(EPOLL_CTL_ADD,fd,events,data) == -1) return -1;
+      }
+    }
+    else
+      if (epollctl(EPOLL_CTL_ADD,fd,events,data) == -1) {
+        if (errno != error_exist) return -1;
+        if (epollctl(EPOLL_CTL_MOD,fd,events,data) == -1) return -1;
+      }
+    s->events = events;
+    s->data = data;
+    return 0;
+  }
+#endif
+
+  if (!s->events) {
+    if (ionum == iolen) {
+      if (!alloc_re(&io,iolen * sizeof(iopause_fd),(iolen + 64) * sizeof(iopause_fd)))
+        return -1;
+      iolen += 64;
+    }
+    s->pos = ++ionum;
+    io[s->pos - 1].fd = fd;
+  }
+  io[s->pos - 1].events = 0;
+  if (events & EVENT_READ) io[s->pos - 1].events |= IOPAUSE_READ;
+  if (events & EVENT_WRITE) io[s->pos - 1].events |= IOPAUSE_WRITE;
+  s->events = events;
+  s->data = data;
+  return 0;
+}
+
+void event_del(int fd,unsigned int data)
+{
+  struct fdstate *s;
+  unsigned int pos;
+
+  if ((fd < 0) || (fd >= fdslen)) return;
+  s = fds + fd;
+  if (!s->events) return;
+  if (s->data != data) return; /* descriptor was reused by someone else */
+  s->events = 0;
+
+#ifdef HASEPOLL
+  if (epfd != -1) {
+    epollctl(EPOLL_CTL_DEL,fd,0,data); /* ENOENT, EBADF: already closed */
+    return;
+  }
+#endif
+
+  pos = s->pos - 1;
+  if (pos != --ionum) {
+    io[pos] = io[ionum];
+    fds[io[pos].fd].pos = pos + 1;
+  }
+}
+
+int event_wait(struct event *ready,unsigned int max,struct taia *deadline,struct taia *stamp)
+{
+  struct taia t;
+  int millisecs;
+  double d;
+  unsigned int i;
+  int n;
+
+  if (taia_less(deadline,stamp))
+    millisecs = 0;
+  else {
+    t = *stamp;
+    taia_sub(&t,deadline,&t);
+    d = taia_approx(&t);
+    if (d > 1000.0) d = 1000.0;
+    millisecs = d * 1000.0 + 20.0;
+  }
+
+#ifdef HASEPOLL
+  if (epfd != -1) {
+    struct epoll_event ev[64];
+
+    if (max > 64) max = 64;
+    n = epoll_wait(epfd,ev,max,millisecs);
+    if (n <= 0) return 0;
+    for (i = 0;i < n;++i) {
+      ready[i].data = ev[i].data.u64;
+      ready[i].revents = 0;
+      if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) ready[i].revents |= EVENT_READ;
+      if (ev[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) ready[i].revents |= EVENT_WRITE;
+    }
+    return n;
+  }
+#endif
+
+  iopause(io,ionum,deadline,stamp);
+  n = 0;
+  for (i = 0;i < ionum;++i)
+    if (io[i].revents) {
+      if (n == max) break;
+      ready[n].data = fds[io[i].fd].data;
+      ready[n].revents = 0;
+      if (io[i].revents & IOPAUSE_READ) ready[n].revents |= EVENT_READ;
+      if (io[i].revents & IOPAUSE_WRITE) ready[n].revents |= EVENT_WRITE;
+      if (!ready[n].revents) ready[n].revents = EVENT_READ | EVENT_WRITE;
+      ++n;
+    }
+  return n;
+}
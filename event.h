@@ -0,0 +1,19 @@
+#ifndef EVENT_H
+#define EVENT_H
+
+#include "taia.h"
+
+#define EVENT_READ 1
+#define EVENT_WRITE 4
+
+struct event {
+  unsigned int data;
+  int revents;
+} ;
+
+extern void event_init(void);
+extern int event_set(int,int,unsigned int);
+extern void event_del(int,unsigned int);
+extern int event_wait(struct event *,unsigned int,struct taia *,struct taia *);
+
+#endif
@@ -3,8 +3,14 @@
 #include "uint16.h"
 #include "error.h"
 #include "byte.h"
+#include "tai.h"
+#include "cache.h"
 #include "log.h"
 
+/* holds the longest line, so each line reaches the log in one write() */
+static char logspace[4096];
+static buffer b = BUFFER_INIT(buffer_unixwrite,2,logspace,sizeof logspace);
+
 /* work around gcc 2.95.2 bug */
 #define number(x) ( (u64 = (x)), u64_print() )
 static uint64 u64;
@@ -20,24 +26,24 @@ static void u64_print(void)
     u64 /= 10;
   } while(u64);
 
-  buffer_put(buffer_2,buf + pos,sizeof buf - pos);
+  buffer_put(&b,buf + pos,sizeof buf - pos);
 }
 
 static void hex(unsigned char c)
 {
-  buffer_put(buffer_2,"0123456789abcdef" + (c >> 4),1);
-  buffer_put(buffer_2,"0123456789abcdef" + (c & 15),1);
+  buffer_put(&b,"0123456789abcdef" + (c >> 4),1);
+  buffer_put(&b,"0123456789abcdef" + (c & 15),1);
 }
 
 static void string(const char *s)
 {
-  buffer_puts(buffer_2,s);
+  buffer_puts(&b,s);
 }
 
 static void line(void)
 {
   string("\n");
-  buffer_flush(buffer_2);
+  buffer_flush(&b);
 }
 
 static void space(void)
@@ -82,7 +88,7 @@ static void name(const char *q)
       --state;
       if ((ch <= 32) || (ch > 126)) ch = '?';
       if ((ch >= 'A') && (ch <= 'Z')) ch += 32;
-      buffer_put(buffer_2,&ch,1);
+      buffer_put(&b,&ch,1);
     }
     string(".");
   }
@@ -103,6 +109,13 @@ void log_query(uint64 *qnum,const char client[4],unsigned int port,const char id
   line();
 }
 
+void log_refresh(uint64 *qnum,const char *q,const char qtype[2])
+{
+  string("refresh "); number(*qnum); space();
+  logtype(qtype); space(); name(q);
+  line();
+}
+
 void log_querydone(uint64 *qnum,unsigned int len)
 {
   string("sent "); number(*qnum); space();
@@ -278,11 +291,94 @@ void log_stats(void)
   extern uint64 cache_motion;
   extern int uactive;
   extern int tactive;
+  extern uint64 numudprecv;
+  extern uint64 numudprecvcalls;
+  extern uint64 numudpsent;
+  extern uint64 numudpsendcalls;
 
   string("stats ");
   number(numqueries); space();
   number(cache_motion); space();
   number(uactive); space();
-  number(tactive);
+  number(tactive); space();
+  number(numudprecv); space();
+  number(numudprecvcalls); space();
+  number(numudpsent); space();
+  number(numudpsendcalls);
+  line();
+}
+
+#define TYPEHITS 16 /* types listed, most hits first; the rest are other */
+
+void log_cachestats(void)
+{
+  extern uint64 query_numlame;
+  extern uint64 query_numlameskipped;
+  extern uint64 dns_rtt_numdead;
+  extern uint64 dns_rtt_numskipped;
+  extern uint64 dns_transmit_numhedges;
+  extern uint64 dns_transmit_numudp;
+  extern uint64 dns_transmit_numsockets;
+  static struct tai last;
+  static uint64 lastevicted;
+  static int flaglast = 0;
+  struct tai now;
+  struct tai elapsed;
+  uint64 rate;
+  uint64 other;
+  char listed[256];
+  double d;
+  int i;
+  int j;
+  int k;
+
+  tai_now(&now);
+  rate = 0;
+  if (flaglast) {
+    tai_sub(&elapsed,&now,&last);
+    d = tai_approx(&elapsed);
+    if (d >= 1) rate = (cache_evicted - lastevicted) / d;
+  }
+  last = now;
+  lastevicted = cache_evicted;
+  flaglast = 1;
+
+  string("cachestats");
+  string(" hits "); number(cache_hits);
+  string(" misses "); number(cache_misses);
+  string(" expired "); number(cache_expired);
+  string(" displaced "); number(cache_displaced);
+  string(" evicted "); number(cache_evicted);
+  string(" evictedpersec "); number(rate);
+  string(" motion "); number(cache_motion);
+  string(" occupancy ");
+  for (i = 0;i <= 2 * CACHE_SLOTS;++i) {
+    if (i) string(",");
+    number(cache_occupancy[i]);
+  }
+  string(" typehits");
+  byte_zero(listed,sizeof listed);
+  for (k = 0;k < TYPEHITS;++k) {
+    j = -1;
+    for (i = 0;i < 256;++i)
+      if (cache_typehits[i] && !listed[i])
+        if ((j == -1) || (cache_typehits[i] > cache_typehits[j])) j = i;
+    if (j == -1) break;
+    listed[j] = 1;
+    space(); number(j); string(":"); number(cache_typehits[j]);
+  }
+  other = cache_typehits[256];
+  for (i = 0;i < 256;++i)
+    if (!listed[i]) other += cache_typehits[i];
+  if (other) {
+    string(" other:"); number(other);
+  }
+  string(" lame "); number(query_numlame);
+  string(" lameskipped "); number(query_numlameskipped);
+  string(" dead "); number(dns_rtt_numdead);
+  string(" deadskipped "); number(dns_rtt_numskipped);
+  string(" hedges "); number(dns_transmit_numhedges);
+  string(" udp "); number(dns_transmit_numudp);
+  string(" sockets "); number(dns_transmit_numsockets);
   line();
 }
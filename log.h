@@ -8,6 +8,7 @@ extern void log_startup(void);
 extern void log_query(uint64 *,const char *,unsigned int,const char *,const char *,const char *);
 extern void log_querydrop(uint64 *);
 extern void log_querydone(uint64 *,unsigned int);
+extern void log_refresh(uint64 *,const char *,const char *);
 
 extern void log_tcpopen(const char *,unsigned int);
 extern void log_tcpclose(const char *,unsigned int);
@@ -32,5 +33,6 @@ extern void log_rrmx(const char *,const char *,const char *,const char *,unsigne
 extern void log_rrsoa(const char *,const char *,const char *,const char *,const char *,unsigned int);
 
 extern void log_stats(void);
+extern void log_cachestats(void);
 
 #endif
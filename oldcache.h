@@ -0,0 +1,12 @@
+#ifndef OLDCACHE_H
+#define OLDCACHE_H
+
+#include "uint32.h"
+#include "uint64.h"
+
+extern uint64 oldcache_motion;
+extern int oldcache_init(unsigned int);
+extern void oldcache_set(const char *,unsigned int,const char *,unsigned int,uint32);
+extern char *oldcache_get(const char *,unsigned int,unsigned int *,uint32 *);
+
+#endif
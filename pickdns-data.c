@@ -26,22 +26,40 @@ void nomem(void)
   strerr_die2x(111,FATAL,"out of memory");
 }
 
+/* a.b.c, or a.b.c.d/n: 4 bytes, then n unless n is a multiple of 8 */
 void ipprefix_cat(stralloc *out,char *s)
 {
   unsigned long u;
   char ch;
   unsigned int j;
+  unsigned int start;
 
+  start = out->len;
   for (;;)
     if (*s == '.')
       ++s;
     else {
       j = scan_ulong(s,&u);
-      if (!j) return;
+      if (!j) break;
       s += j;
       ch = u;
       if (!stralloc_catb(out,&ch,1)) nomem();
     }
+
+  if (*s != '/') return;
+  if (out->len - start > 4) return;
+  if (!scan_ulong(s + 1,&u)) return;
+  if (u > 32) u = 32;
+  if (!stralloc_catb(out,"\0\0\0\0",4)) nomem();
+  out->len = start + 4;
+  for (j = u;j < 32;++j)
+    out->s[start + j / 8] &= ~(128 >> (j & 7));
+  if (u & 7) {
+    ch = u;
+    if (!stralloc_catb(out,&ch,1)) nomem();
+  }
+  else
+    out->len = start + u / 8;
 }
 
 struct address {
@@ -2,8 +2,9 @@
 #include "byte.h"
 #include "case.h"
 #include "dns.h"
-#include "open.h"
 #include "cdb.h"
+#include "datacdb.h"
+#include "clientloc.h"
 #include "response.h"
 
 const char *fatal = "pickdns: fatal: ";
@@ -36,20 +37,8 @@ static int doit(char *q,char qtype[2],char ip[4])
   if (byte_equal(qtype,2,DNS_T_ANY)) flaga = flagmx = 1;
   if (!flaga && !flagmx) goto REFUSE;
 
-  key[0] = '%';
-  byte_copy(key + 1,4,ip);
-
-  r = cdb_find(&c,key,5);
-  if (!r) r = cdb_find(&c,key,4);
-  if (!r) r = cdb_find(&c,key,3);
-  if (!r) r = cdb_find(&c,key,2);
-  if (r == -1) return 0;
-
   key[0] = '+';
-  byte_zero(key + 1,2);
-  if (r && (cdb_datalen(&c) == 2))
-    if (cdb_read(&c,key + 1,2,cdb_datapos(&c)) == -1) return 0;
-
+  clientloc_find(key + 1,ip);
   byte_copy(key + 3,qlen,q);
   case_lowerb(key + 3,qlen + 3);
 
@@ -86,16 +75,16 @@ static int doit(char *q,char qtype[2],char ip[4])
   return 1;
 }
 
+static int flagloc = 0;
+static uint32 locgen;
+
 int respond(char *q,char qtype[2],char ip[4])
 {
-  int fd;
-  int result;
-
-  fd = open_read("data.cdb");
-  if (fd == -1) return 0;
-  cdb_init(&c,fd);
-  result = doit(q,qtype,ip);
-  cdb_free(&c);
-  close(fd);
-  return result;
+  if (!datacdb(&c)) return 0;
+  if (!flagloc || (locgen != datacdb_generation)) {
+    if (!clientloc_load(&c,"%",1)) { flagloc = 0; return 0; }
+    locgen = datacdb_generation;
+    flagloc = 1;
+  }
+  return doit(q,qtype,ip);
 }
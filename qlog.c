@@ -1,9 +1,13 @@
 #include "buffer.h"
 #include "qlog.h"
 
+/* holds the longest line, so each line reaches the log in one write() */
+static char qlogspace[4096];
+static buffer b = BUFFER_INIT(buffer_unixwrite,2,qlogspace,sizeof qlogspace);
+
 static void put(char c)
 {
-  buffer_put(buffer_2,&c,1);
+  buffer_put(&b,&c,1);
 }
 
 static void hex(unsigned char c)
@@ -35,7 +39,7 @@ void qlog(const char ip[4],uint16 port,const char id[2],const char *q,const char
   put(':');
   hex(id[0]);
   hex(id[1]);
-  buffer_puts(buffer_2,result);
+  buffer_puts(&b,result);
   hex(qtype[0]);
   hex(qtype[1]);
   put(' ');
@@ -59,5 +63,5 @@ void qlog(const char ip[4],uint16 port,const char id[2],const char *q,const char
     }
 
   put('\n');
-  buffer_flush(buffer_2);
+  buffer_flush(&b);
 }
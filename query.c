@@ -35,6 +35,60 @@ static void cachegeneric(const char type[2],const char *d,const char *data,unsig
   cache_set(key,len + 2,data,datalen,ttl);
 }
 
+/*
+A server found lame for a zone stays in the cache for LAMETTL seconds,
+keyed by 2 bytes, a 0 byte, the server, and the zone. A query key is
+a type and a name, and a name starting with 0 is the root, so no query
+key is longer than 3 bytes with a 0 there. Later queries drop the
+server from the zone's servers before transmitting.
+*/
+
+#define LAMETTL 900
+
+uint64 query_numlame = 0;
+uint64 query_numlameskipped = 0;
+
+static unsigned int lamekey(char key[7 + 255],const char ip[4],const char *control)
+{
+  unsigned int len;
+
+  len = dns_domain_length(control);
+  if (len > 255) return 0;
+  byte_copy(key,3,"\377\1\0");
+  byte_copy(key + 3,4,ip);
+  byte_copy(key + 7,len,control);
+  case_lowerb(key + 7,len);
+  return len + 7;
+}
+
+static void lame_set(const char ip[4],const char *control)
+{
+  char key[7 + 255];
+  unsigned int len;
+
+  ++query_numlame;
+  len = lamekey(key,ip,control);
+  if (len) cache_set(key,len,"",0,LAMETTL);
+}
+
+static void lame_drop(char servers[64],const char *control)
+{
+  char key[7 + 255];
+  unsigned int len;
+  unsigned int datalen;
+  uint32 ttl;
+  int j;
+
+  for (j = 0;j < 64;j += 4)
+    if (byte_diff(servers + j,4,"\0\0\0\0")) {
+      len = lamekey(key,servers + j,control);
+      if (len && cache_get(key,len,&datalen,&ttl)) {
+        byte_zero(servers + j,4);
+        ++query_numlameskipped;
+      }
+    }
+}
+
 static char save_buf[8192];
 static unsigned int save_len;
 static unsigned int save_ok;
@@ -240,18 +294,17 @@ static int doit(struct query *z,int state)
     return 1;
   }
 
-  if (dlen <= 255) {
-    byte_copy(key,2,DNS_T_ANY);
+  if ((dlen <= 255) && !(z->refresh && !z->level)) {
     byte_copy(key + 2,dlen,d);
     case_lowerb(key + 2,dlen);
-    cached = cache_get(key,dlen + 2,&cachedlen,&ttl);
+    cache_name(key + 2,dlen);
+    cached = cache_type(DNS_T_ANY,&cachedlen,&ttl);
     if (cached) {
       log_cachednxdomain(d);
       goto NXDOMAIN;
     }
 
-    byte_copy(key,2,DNS_T_CNAME);
-    cached = cache_get(key,dlen + 2,&cachedlen,&ttl);
+    cached = cache_type(DNS_T_CNAME,&cachedlen,&ttl);
     if (cached) {
       if (typematch(DNS_T_CNAME,dtype)) {
         log_cachedanswer(d,DNS_T_CNAME);
@@ -266,8 +319,7 @@ static int doit(struct query *z,int state)
     }
 
     if (typematch(DNS_T_NS,dtype)) {
-      byte_copy(key,2,DNS_T_NS);
-      cached = cache_get(key,dlen + 2,&cachedlen,&ttl);
+      cached = cache_type(DNS_T_NS,&cachedlen,&ttl);
       if (cached && (cachedlen || byte_diff(dtype,2,DNS_T_ANY))) {
 	log_cachedanswer(d,DNS_T_NS);
 	if (!rqa(z)) goto DIE;
@@ -283,8 +335,7 @@ static int doit(struct query *z,int state)
     }
 
     if (typematch(DNS_T_PTR,dtype)) {
-      byte_copy(key,2,DNS_T_PTR);
-      cached = cache_get(key,dlen + 2,&cachedlen,&ttl);
+      cached = cache_type(DNS_T_PTR,&cachedlen,&ttl);
       if (cached && (cachedlen || byte_diff(dtype,2,DNS_T_ANY))) {
 	log_cachedanswer(d,DNS_T_PTR);
 	if (!rqa(z)) goto DIE;
@@ -300,8 +351,7 @@ static int doit(struct query *z,int state)
     }
 
     if (typematch(DNS_T_MX,dtype)) {
-      byte_copy(key,2,DNS_T_MX);
-      cached = cache_get(key,dlen + 2,&cachedlen,&ttl);
+      cached = cache_type(DNS_T_MX,&cachedlen,&ttl);
       if (cached && (cachedlen || byte_diff(dtype,2,DNS_T_ANY))) {
 	log_cachedanswer(d,DNS_T_MX);
 	if (!rqa(z)) goto DIE;
@@ -320,8 +370,7 @@ static int doit(struct query *z,int state)
     }
 
     if (typematch(DNS_T_A,dtype)) {
-      byte_copy(key,2,DNS_T_A);
-      cached = cache_get(key,dlen + 2,&cachedlen,&ttl);
+      cached = cache_type(DNS_T_A,&cachedlen,&ttl);
       if (cached && (cachedlen || byte_diff(dtype,2,DNS_T_ANY))) {
 	if (z->level) {
 	  log_cachedanswer(d,DNS_T_A);
@@ -352,8 +401,7 @@ static int doit(struct query *z,int state)
     }
 
     if (!typematch(DNS_T_ANY,dtype) && !typematch(DNS_T_AXFR,dtype) && !typematch(DNS_T_CNAME,dtype) && !typematch(DNS_T_NS,dtype) && !typematch(DNS_T_PTR,dtype) && !typematch(DNS_T_A,dtype) && !typematch(DNS_T_MX,dtype)) {
-      byte_copy(key,2,dtype);
-      cached = cache_get(key,dlen + 2,&cachedlen,&ttl);
+      cached = cache_type(dtype,&cachedlen,&ttl);
       if (cached && (cachedlen || byte_diff(dtype,2,DNS_T_ANY))) {
 	log_cachedanswer(d,dtype);
 	if (!rqa(z)) goto DIE;
@@ -423,12 +471,13 @@ static int doit(struct query *z,int state)
       dns_domain_free(&z->ns[z->level][j]);
     }
 
+  lame_drop(z->servers[z->level],z->control[z->level]);
   for (j = 0;j < 64;j += 4)
     if (byte_diff(z->servers[z->level] + j,4,"\0\0\0\0"))
       break;
   if (j == 64) goto SERVFAIL;
 
-  dns_sortip(z->servers[z->level],64);
+  dns_rtt_sort(z->servers[z->level],64);
   if (z->level) {
     log_tx(z->name[z->level],DNS_T_A,z->control[z->level],z->servers[z->level],z->level);
     if (dns_transmit_start(&z->dt,z->servers[z->level],flagforwardonly,z->name[z->level],DNS_T_A,z->localip) == -1) goto DIE;
@@ -519,6 +568,7 @@ static int doit(struct query *z,int state)
   if (!flagcname && !rcode && !flagout && flagreferral && !flagsoa)
     if (dns_domain_equal(referral,control) || !dns_domain_suffix(referral,control)) {
       log_lame(whichserver,control,referral);
+      lame_set(whichserver,control);
       byte_zero(whichserver,4);
       goto HAVENS;
     }
@@ -818,13 +868,14 @@ static int doit(struct query *z,int state)
   return -1;
 }
 
-int query_start(struct query *z,char *dn,char type[2],char class[2],char localip[4])
+static int start(struct query *z,char *dn,char type[2],char class[2],char localip[4],int refresh)
 {
   if (byte_equal(type,2,DNS_T_AXFR)) { errno = error_perm; return -1; }
 
   cleanup(z);
   z->level = 0;
   z->loop = 0;
+  z->refresh = refresh;
 
   if (!dns_domain_copy(&z->name[0],dn)) return -1;
   byte_copy(z->type,2,type);
@@ -834,6 +885,17 @@ int query_start(struct query *z,char *dn,char type[2],char class[2],char localip
   return doit(z,0);
 }
 
+int query_start(struct query *z,char *dn,char type[2],char class[2],char localip[4])
+{
+  return start(z,dn,type,class,localip,0);
+}
+
+/* resolve again, to replace cached answers that are about to expire */
+int query_refresh(struct query *z,char *dn,char type[2],char class[2],char localip[4])
+{
+  return start(z,dn,type,class,localip,1);
+}
+
 int query_get(struct query *z,iopause_fd *x,struct taia *stamp)
 {
   switch(dns_transmit_get(&z->dt,x,stamp)) {
@@ -20,10 +20,12 @@ struct query {
   char localip[4];
   char type[2];
   char class[2];
+  int refresh; /* 1: ignore cached answers for name[0] and its aliases */
   struct dns_transmit dt;
 } ;
 
 extern int query_start(struct query *,char *,char *,char *,char *);
+extern int query_refresh(struct query *,char *,char *,char *,char *);
 extern void query_io(struct query *,iopause_fd *,struct taia *);
 extern int query_get(struct query *,iopause_fd *,struct taia *);
 
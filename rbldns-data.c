@@ -13,6 +13,7 @@
 #include "scan.h"
 #include "fmt.h"
 #include "ip4.h"
+#include "sgetopt.h"
 
 #define FATAL "rbldns-data: fatal: "
 
@@ -45,13 +46,24 @@ void die_datatmp(void)
   strerr_die2sys(111,FATAL,"unable to create data.tmp: ");
 }
 
-int main()
+int main(int argc,char **argv)
 {
   char ip[4];
   unsigned long u;
   unsigned int j;
   unsigned int k;
   char ch;
+  int opt;
+  int flagcdb2 = 0;
+
+  while ((opt = getopt(argc,argv,"2")) != opteof)
+    switch(opt) {
+      case '2':
+	flagcdb2 = 1;
+	break;
+      default:
+	strerr_die1x(100,"rbldns-data: usage: rbldns-data [ -2 ]");
+    }
 
   umask(022);
 
@@ -61,7 +73,7 @@ int main()
 
   fdcdb = open_trunc("data.tmp");
   if (fdcdb == -1) die_datatmp();
-  if (cdb_make_start(&cdb,fdcdb) == -1) die_datatmp();
+  if ((flagcdb2 ? cdb_make_start2(&cdb,fdcdb) : cdb_make_start(&cdb,fdcdb)) == -1) die_datatmp();
 
   while (match) {
     ++linenum;
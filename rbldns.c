@@ -2,9 +2,9 @@
 #include "str.h"
 #include "byte.h"
 #include "ip4.h"
-#include "open.h"
 #include "env.h"
 #include "cdb.h"
+#include "datacdb.h"
 #include "dns.h"
 #include "dd.h"
 #include "strerr.h"
@@ -26,6 +26,7 @@ static int doit(char *q,char qtype[2])
   uint32 ipnum;
   int r;
   uint32 dlen;
+  char *x;
   int i;
 
   flaga = byte_equal(qtype,2,DNS_T_A);
@@ -52,28 +53,32 @@ static int doit(char *q,char qtype[2])
   if (r == -1) return 0;
   if (r && ((dlen = cdb_datalen(&c)) >= 4)) {
     if (dlen > 100) dlen = 100;
-    if (cdb_read(&c,data,dlen,cdb_datapos(&c)) == -1) return 0;
+    x = cdb_getptr(&c,data,dlen,cdb_datapos(&c));
+    if (!x) return 0;
   }
   else {
     dlen = 12;
-    byte_copy(data,dlen,"\177\0\0\2Listed $");
+    x = data;
+    byte_copy(x,dlen,"\177\0\0\2Listed $");
   }
 
-  if ((dlen >= 5) && (data[dlen - 1] == '$')) {
+  if ((dlen >= 5) && (x[dlen - 1] == '$')) {
     --dlen;
+    byte_copy(data,dlen,x);
     dlen += ip4_fmt(data + dlen,ip);
+    x = data;
   }
 
   if (flaga) {
     if (!response_rstart(q,DNS_T_A,2048)) return 0;
-    if (!response_addbytes(data,4)) return 0;
+    if (!response_addbytes(x,4)) return 0;
     response_rfinish(RESPONSE_ANSWER);
   }
   if (flagtxt) {
     if (!response_rstart(q,DNS_T_TXT,2048)) return 0;
     ch = dlen - 4;
     if (!response_addbytes(&ch,1)) return 0;
-    if (!response_addbytes(data + 4,dlen - 4)) return 0;
+    if (!response_addbytes(x + 4,dlen - 4)) return 0;
     response_rfinish(RESPONSE_ANSWER);
   }
 
@@ -89,16 +94,8 @@ static int doit(char *q,char qtype[2])
 
 int respond(char *q,char qtype[2],char ip[4])
 {
-  int fd;
-  int result;
-
-  fd = open_read("data.cdb");
-  if (fd == -1) return 0;
-  cdb_init(&c,fd);
-  result = doit(q,qtype);
-  cdb_free(&c);
-  close(fd);
-  return result;
+  if (!datacdb(&c)) return 0;
+  return doit(q,qtype);
 }
 
 const char *fatal = "rbldns: fatal: ";
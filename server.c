@@ -1,3 +1,4 @@
+#include <unistd.h>
 #include "byte.h"
 #include "case.h"
 #include "env.h"
@@ -11,6 +12,9 @@
 #include "qlog.h"
 #include "response.h"
 #include "dns.h"
+#include "fmt.h"
+#include "scan.h"
+#include "workers.h"
 
 extern char *fatal;
 extern char *starting;
@@ -20,9 +24,21 @@ extern void initialize(void);
 static char ip[4];
 static uint16 port;
 
-static char buf[513];
+static int udp53s[WORKERS_MAX];
+
+static char *buf;
 static int len;
 
+static char bufs[SOCKET_BATCH][513];
+static struct socket_dgram in[SOCKET_BATCH];
+static char outs[SOCKET_BATCH][512];
+static struct socket_dgram out[SOCKET_BATCH];
+
+static unsigned long numrecv = 0;
+static unsigned long numrecvcalls = 0;
+static unsigned long numsent = 0;
+static unsigned long numsendcalls = 0;
+
 static char *q;
 
 static int doit(void)
@@ -32,7 +48,7 @@ static int doit(void)
   char qtype[2];
   char qclass[2];
 
-  if (len >= sizeof buf) goto NOQ;
+  if (len >= sizeof bufs[0]) goto NOQ;
   pos = dns_packet_copy(buf,len,0,header,12); if (!pos) goto NOQ;
   if (header[2] & 128) goto NOQ;
   if (header[4]) goto NOQ;
@@ -79,10 +95,35 @@ static int doit(void)
   return 0;
 }
 
+static void number(unsigned long u)
+{
+  char strnum[FMT_ULONG];
+
+  buffer_put(buffer_2," ",1);
+  buffer_put(buffer_2,strnum,fmt_ulong(strnum,u));
+}
+
+static void stats(void)
+{
+  buffer_puts(buffer_2,"stats");
+  number(numrecv);
+  number(numrecvcalls);
+  number(numsent);
+  number(numsendcalls);
+  buffer_putsflush(buffer_2,"\n");
+}
+
 int main()
 {
   char *x;
   int udp53;
+  int n;
+  int i;
+  int k;
+  unsigned long workers;
+  unsigned int numworkers;
+  unsigned int worker;
+  unsigned int w;
 
   x = env_get("IP");
   if (!x)
@@ -90,27 +131,69 @@ int main()
   if (!ip4_scan(x,ip))
     strerr_die3x(111,fatal,"unable to parse IP address ",x);
 
-  udp53 = socket_udp();
-  if (udp53 == -1)
-    strerr_die2sys(111,fatal,"unable to create UDP socket: ");
-  if (socket_bind4_reuse(udp53,ip,53) == -1)
-    strerr_die2sys(111,fatal,"unable to bind UDP socket: ");
+  workers = 1;
+  x = env_get("WORKERS");
+  if (x) scan_ulong(x,&workers);
+  if (workers < 1) workers = 1;
+  if (workers > WORKERS_MAX) workers = WORKERS_MAX;
+  numworkers = workers;
+
+  for (w = 0;w < numworkers;++w) {
+    udp53s[w] = socket_udp();
+    if (udp53s[w] == -1)
+      strerr_die2sys(111,fatal,"unable to create UDP socket: ");
+    if (((numworkers > 1) ? socket_bind4_reuseport(udp53s[w],ip,53) : socket_bind4_reuse(udp53s[w],ip,53)) == -1)
+      strerr_die2sys(111,fatal,"unable to bind UDP socket: ");
+  }
 
   droproot(fatal);
 
   initialize();
-  
-  ndelay_off(udp53);
-  socket_tryreservein(udp53,65536);
 
   buffer_putsflush(buffer_2,starting);
 
+  /* each worker has its own socket, response buffer, and data.cdb map */
+  worker = workers_start(numworkers,fatal);
+  dns_random_worker(worker); /* initialize() seeded before the fork */
+  udp53 = udp53s[worker];
+  for (w = 0;w < numworkers;++w)
+    if (udp53s[w] != udp53) close(udp53s[w]);
+
+  ndelay_off(udp53);
+  socket_tryreservein(udp53,65536);
+
   for (;;) {
-    len = socket_recv4(udp53,buf,sizeof buf,ip,&port);
-    if (len < 0) continue;
-    if (!doit()) continue;
-    if (response_len > 512) response_tc();
-    socket_send4(udp53,response,response_len,ip,port);
-    /* may block for buffer space; if it fails, too bad */
+    for (i = 0;i < SOCKET_BATCH;++i) {
+      in[i].buf = bufs[i];
+      in[i].len = sizeof bufs[i];
+    }
+    n = socket_recvmany4(udp53,in,SOCKET_BATCH);
+    if (n <= 0) continue;
+    numrecv += n;
+    ++numrecvcalls;
+
+    k = 0;
+    for (i = 0;i < n;++i) {
+      buf = in[i].buf;
+      len = in[i].len;
+      byte_copy(ip,4,in[i].ip);
+      port = in[i].port;
+      if (!doit()) continue;
+      if (response_len > 512) response_tc();
+      byte_copy(outs[k],response_len,response);
+      out[k].buf = outs[k];
+      out[k].len = response_len;
+      byte_copy(out[k].ip,4,ip);
+      out[k].port = port;
+      ++k;
+    }
+
+    if (k) {
+      numsent += socket_sendmany4(udp53,out,k);
+      /* may block for buffer space; if it fails, too bad */
+      ++numsendcalls;
+    }
+
+    if (!(numrecvcalls & 1023)) stats();
   }
 }
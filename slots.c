@@ -0,0 +1,101 @@
+#include "alloc.h"
+#include "slots.h"
+
+/*
+A pool of len numbered slots.
+Free slots are kept on a stack, so slots_get() is O(1).
+Busy slots are kept in a binary heap ordered by start time,
+so slots_oldest() is O(1) and slots_start()/slots_stop() are O(log len).
+*/
+
+int slots_init(struct slots *s,unsigned int len)
+{
+  unsigned int i;
+
+  s->len = len;
+  s->free = (unsigned int *) alloc(len * sizeof(unsigned int));
+  s->heap = (unsigned int *) alloc(len * sizeof(unsigned int));
+  s->pos = (unsigned int *) alloc(len * sizeof(unsigned int));
+  s->start = (struct taia *) alloc(len * sizeof(struct taia));
+  if (!s->free || !s->heap || !s->pos || !s->start) return 0;
+
+  for (i = 0;i < len;++i)
+    s->free[i] = len - 1 - i;
+  s->freenum = len;
+  s->heapnum = 0;
+  return 1;
+}
+
+int slots_get(struct slots *s)
+{
+  if (!s->freenum) return -1;
+  return s->free[--s->freenum];
+}
+
+void slots_put(struct slots *s,unsigned int j)
+{
+  s->free[s->freenum++] = j;
+}
+
+static int earlier(struct slots *s,unsigned int i,unsigned int k)
+{
+  return taia_less(&s->start[s->heap[i]],&s->start[s->heap[k]]);
+}
+
+static void swap(struct slots *s,unsigned int i,unsigned int k)
+{
+  unsigned int j;
+
+  j = s->heap[i]; s->heap[i] = s->heap[k]; s->heap[k] = j;
+  s->pos[s->heap[i]] = i;
+  s->pos[s->heap[k]] = k;
+}
+
+static void up(struct slots *s,unsigned int i)
+{
+  while (i && earlier(s,i,(i - 1) >> 1)) {
+    swap(s,i,(i - 1) >> 1);
+    i = (i - 1) >> 1;
+  }
+}
+
+static void down(struct slots *s,unsigned int i)
+{
+  unsigned int k;
+
+  for (;;) {
+    k = 2 * i + 1;
+    if (k >= s->heapnum) return;
+    if ((k + 1 < s->heapnum) && earlier(s,k + 1,k)) ++k;
+    if (!earlier(s,k,i)) return;
+    swap(s,i,k);
+    i = k;
+  }
+}
+
+void slots_start(struct slots *s,unsigned int j,const struct taia *start)
+{
+  s->start[j] = *start;
+  s->heap[s->heapnum] = j;
+  s->pos[j] = s->heapnum;
+  up(s,s->heapnum++);
+}
+
+void slots_stop(struct slots *s,unsigned int j)
+{
+  unsigned int i;
+
+  i = s->pos[j];
+  if (i != --s->heapnum) {
+    swap(s,i,s->heapnum);
+    up(s,i);
+    down(s,i);
+  }
+  slots_put(s,j);
+}
+
+int slots_oldest(struct slots *s)
+{
+  if (!s->heapnum) return -1;
+  return s->heap[0];
+}
@@ -0,0 +1,23 @@
+#ifndef SLOTS_H
+#define SLOTS_H
+
+#include "taia.h"
+
+struct slots {
+  unsigned int len;
+  unsigned int *free; /* stack of free slot numbers */
+  unsigned int freenum;
+  unsigned int *heap; /* busy slots, earliest start on top */
+  unsigned int heapnum;
+  unsigned int *pos; /* position of each busy slot in heap */
+  struct taia *start;
+} ;
+
+extern int slots_init(struct slots *,unsigned int);
+extern int slots_get(struct slots *);
+extern void slots_put(struct slots *,unsigned int);
+extern void slots_start(struct slots *,unsigned int,const struct taia *);
+extern void slots_stop(struct slots *,unsigned int);
+extern int slots_oldest(struct slots *);
+
+#endif
@@ -10,6 +10,7 @@ extern int socket_connect4(int,const char *,uint16);
 extern int socket_connected(int);
 extern int socket_bind4(int,char *,uint16);
 extern int socket_bind4_reuse(int,char *,uint16);
+extern int socket_bind4_reuseport(int,char *,uint16);
 extern int socket_listen(int,int);
 extern int socket_accept4(int,char *,uint16 *);
 extern int socket_recv4(int,char *,int,char *,uint16 *);
@@ -19,4 +20,16 @@ extern int socket_remote4(int,char *,uint16 *);
 
 extern void socket_tryreservein(int,int);
 
+#define SOCKET_BATCH 32
+
+struct socket_dgram {
+  char *buf;
+  unsigned int len; /* space in buf for recv; datagram length after */
+  char ip[4];
+  uint16 port;
+} ;
+
+extern int socket_recvmany4(int,struct socket_dgram *,unsigned int);
+extern int socket_sendmany4(int,struct socket_dgram *,unsigned int);
+
 #endif
@@ -0,0 +1,51 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include "hasmmsg.h"
+#include "byte.h"
+#include "socket.h"
+
+/* blocks, if s is blocking, only until the first datagram arrives */
+
+int socket_recvmany4(int s,struct socket_dgram *d,unsigned int n)
+{
+#ifdef HASMMSG
+  struct mmsghdr m[SOCKET_BATCH];
+  struct iovec iov[SOCKET_BATCH];
+  struct sockaddr_in sa[SOCKET_BATCH];
+  unsigned int i;
+  int r;
+
+  if (n > SOCKET_BATCH) n = SOCKET_BATCH;
+  byte_zero(m,n * sizeof(struct mmsghdr));
+  for (i = 0;i < n;++i) {
+    iov[i].iov_base = d[i].buf;
+    iov[i].iov_len = d[i].len;
+    m[i].msg_hdr.msg_name = &sa[i];
+    m[i].msg_hdr.msg_namelen = sizeof sa[i];
+    m[i].msg_hdr.msg_iov = &iov[i];
+    m[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  r = recvmmsg(s,m,n,MSG_WAITFORONE,0);
+  if (r <= 0) return -1;
+
+  for (i = 0;i < r;++i) {
+    d[i].len = m[i].msg_len;
+    byte_copy(d[i].ip,4,(char *) &sa[i].sin_addr);
+    uint16_unpack_big((char *) &sa[i].sin_port,&d[i].port);
+  }
+  return r;
+#else
+  int r;
+
+  if (!n) return 0;
+  r = socket_recv4(s,d[0].buf,d[0].len,d[0].ip,&d[0].port);
+  if (r == -1) return -1;
+  d[0].len = r;
+  return 1;
+#endif
+}
@@ -0,0 +1,57 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include "hasmmsg.h"
+#include "byte.h"
+#include "socket.h"
+
+/* a datagram that cannot be sent is skipped; returns number sent */
+
+int socket_sendmany4(int s,struct socket_dgram *d,unsigned int n)
+{
+#ifdef HASMMSG
+  struct mmsghdr m[SOCKET_BATCH];
+  struct iovec iov[SOCKET_BATCH];
+  struct sockaddr_in sa[SOCKET_BATCH];
+  unsigned int i;
+  unsigned int k;
+  unsigned int sent;
+  int r;
+
+  sent = 0;
+  while (n) {
+    k = n;
+    if (k > SOCKET_BATCH) k = SOCKET_BATCH;
+    byte_zero(m,k * sizeof(struct mmsghdr));
+    byte_zero(sa,k * sizeof(struct sockaddr_in));
+    for (i = 0;i < k;++i) {
+      sa[i].sin_family = AF_INET;
+      uint16_pack_big((char *) &sa[i].sin_port,d[i].port);
+      byte_copy((char *) &sa[i].sin_addr,4,d[i].ip);
+      iov[i].iov_base = d[i].buf;
+      iov[i].iov_len = d[i].len;
+      m[i].msg_hdr.msg_name = &sa[i];
+      m[i].msg_hdr.msg_namelen = sizeof sa[i];
+      m[i].msg_hdr.msg_iov = &iov[i];
+      m[i].msg_hdr.msg_iovlen = 1;
+    }
+    r = sendmmsg(s,m,k,0);
+    if (r <= 0) r = 1; /* skip the one that failed */
+    else sent += r;
+    d += r;
+    n -= r;
+  }
+  return sent;
+#else
+  unsigned int sent;
+
+  sent = 0;
+  for (;n;++d,--n)
+    if (socket_send4(s,d->buf,d->len,d->ip,d->port) != -1)
+      ++sent;
+  return sent;
+#endif
+}
@@ -1,13 +1,16 @@
 #include <unistd.h>
 #include "uint16.h"
-#include "open.h"
 #include "tai.h"
 #include "cdb.h"
+#include "datacdb.h"
+#include "clientloc.h"
 #include "byte.h"
 #include "case.h"
 #include "dns.h"
 #include "seek.h"
 #include "response.h"
+#include "cache.h"
+#include "alloc.h"
 
 static int want(const char *owner,const char type[2])
 {
@@ -37,13 +40,19 @@ static char clientloc[2];
 static struct tai now;
 static struct cdb c;
 
-static char data[32767];
+static char databuf[32767];
+static char *data;
 static uint32 dlen;
 static unsigned int dpos;
 static char type[2];
 static uint32 ttl;
 
-static int find(char *d,int flagwild)
+static int flagvolatile; /* answer depends on the time or on > 8 A records */
+static unsigned int shufflepos; /* A records that dns_random() ordered */
+static unsigned int shufflenum;
+
+/* next record for d in data.cdb that applies to this client now */
+static int scan(char *d,int *flagwild)
 {
   int r;
   char ch;
@@ -57,8 +66,9 @@ static int find(char *d,int flagwild)
     r = cdb_findnext(&c,d,dns_domain_length(d));
     if (r <= 0) return r;
     dlen = cdb_datalen(&c);
-    if (dlen > sizeof data) return -1;
-    if (cdb_read(&c,data,dlen,cdb_datapos(&c)) == -1) return -1;
+    if (dlen > sizeof databuf) return -1;
+    data = cdb_getptr(&c,databuf,dlen,cdb_datapos(&c));
+    if (!data) return -1;
     dpos = dns_packet_copy(data,dlen,0,type,2); if (!dpos) return -1;
     dpos = dns_packet_copy(data,dlen,dpos,&ch,1); if (!dpos) return -1;
     if ((ch == '=' + 1) || (ch == '*' + 1)) {
@@ -66,11 +76,12 @@ static int find(char *d,int flagwild)
       dpos = dns_packet_copy(data,dlen,dpos,recordloc,2); if (!dpos) return -1;
       if (byte_diff(recordloc,2,clientloc)) continue;
     }
-    if (flagwild != (ch == '*')) continue;
+    *flagwild = (ch == '*');
     dpos = dns_packet_copy(data,dlen,dpos,ttlstr,4); if (!dpos) return -1;
     uint32_unpack_big(ttlstr,&ttl);
     dpos = dns_packet_copy(data,dlen,dpos,ttd,8); if (!dpos) return -1;
     if (byte_diff(ttd,8,"\0\0\0\0\0\0\0\0")) {
+      flagvolatile = 1;
       tai_unpack(ttd,&cutoff);
       if (ttl == 0) {
 	if (tai_less(&cutoff,&now)) continue;
@@ -87,13 +98,149 @@ static int find(char *d,int flagwild)
   }
 }
 
+/*
+Record set: the records of each owner name on the path from q up to
+its zone, read from data.cdb once per query and kept here with the
+header already decoded. Record bodies stay in the map when data.cdb
+is mapped; otherwise they are copied into space. The bailiwick walk,
+the answer and wildcard walk, and the authority section then read
+them from memory. Names in the additional section, or an owner that
+does not fit, are scanned.
+*/
+
+#define SETOWNERS 32
+#define SETRECORDS 256
+#define SPACE 16384
+
+static struct {
+  char *d; /* inside q */
+  unsigned int first;
+  unsigned int num;
+} owner[SETOWNERS];
+static unsigned int owners;
+
+static struct {
+  char *data;
+  unsigned int len;
+  uint32 ttl;
+  char type[2];
+  int flagwild;
+} rec[SETRECORDS];
+static unsigned int recs;
+
+static char *space = 0; /* SPACE bytes, only if data.cdb is not mapped */
+static unsigned int spacelen;
+
+static int cur; /* owner being read, or -1 if scanning data.cdb */
+static unsigned int curpos;
+static char *curd;
+
+static void setclear(void)
+{
+  owners = 0;
+  recs = 0;
+  spacelen = 0;
+}
+
+static int load(char *d)
+{
+  unsigned int first;
+  unsigned int firstspace;
+  unsigned int len;
+  int flagwild;
+  int r;
+
+  first = recs;
+  firstspace = spacelen;
+  cdb_findstart(&c);
+  while (r = scan(d,&flagwild)) {
+    if (r == -1) return -1;
+    len = dlen - dpos;
+    if (recs == SETRECORDS) goto TOOBIG;
+    rec[recs].data = data + dpos;
+    if (data == databuf) {
+      if (!space) space = alloc(SPACE);
+      if (!space) return -1;
+      if (len > SPACE - spacelen) goto TOOBIG;
+      byte_copy(space + spacelen,len,data + dpos);
+      rec[recs].data = space + spacelen;
+      spacelen += len;
+    }
+    rec[recs].len = len;
+    rec[recs].ttl = ttl;
+    byte_copy(rec[recs].type,2,type);
+    rec[recs].flagwild = flagwild;
+    ++recs;
+  }
+  owner[owners].d = d;
+  owner[owners].first = first;
+  owner[owners].num = recs - first;
+  ++owners;
+  return 1;
+
+  TOOBIG:
+  recs = first;
+  spacelen = firstspace;
+  return 0;
+}
+
+/* flagkeep: d stays put for the rest of the query */
+static int findstart(char *d,int flagkeep)
+{
+  unsigned int i;
+  int r;
+
+  curpos = 0;
+  for (i = 0;i < owners;++i)
+    if ((owner[i].d == d) || dns_domain_equal(owner[i].d,d)) {
+      cur = i;
+      return 0;
+    }
+  if (flagkeep && (owners < SETOWNERS)) {
+    r = load(d);
+    if (r == -1) return -1;
+    if (r) {
+      cur = owners - 1;
+      return 0;
+    }
+  }
+  cur = -1;
+  curd = d;
+  cdb_findstart(&c);
+  return 0;
+}
+
+static int find(int flagwild)
+{
+  int r;
+  int w;
+  unsigned int i;
+
+  if (cur == -1)
+    for (;;) {
+      r = scan(curd,&w);
+      if (r <= 0) return r;
+      if (w == flagwild) return 1;
+    }
+
+  while (curpos < owner[cur].num) {
+    i = owner[cur].first + curpos++;
+    if (rec[i].flagwild != flagwild) continue;
+    data = rec[i].data;
+    dlen = rec[i].len;
+    dpos = 0;
+    ttl = rec[i].ttl;
+    byte_copy(type,2,rec[i].type);
+    return 1;
+  }
+  return 0;
+}
+
 static int dobytes(unsigned int len)
 {
-  char buf[20];
-  if (len > 20) return 0;
-  dpos = dns_packet_copy(data,dlen,dpos,buf,len);
-  if (!dpos) return 0;
-  return response_addbytes(buf,len);
+  if (len > dlen - dpos) return 0;
+  dpos += len;
+  return response_addbytes(data + dpos - len,len);
 }
 
 static int doname(void)
@@ -124,13 +271,14 @@ static int doit(char *q,char qtype[2])
   int i;
 
   anpos = response_len;
+  setclear();
 
   control = q;
   for (;;) {
     flagns = 0;
     flagauthoritative = 0;
-    cdb_findstart(&c);
-    while (r = find(control,0)) {
+    if (findstart(control,1) == -1) return 0;
+    while (r = find(0)) {
       if (r == -1) return 0;
       if (byte_equal(type,2,DNS_T_SOA)) flagauthoritative = 1;
       if (byte_equal(type,2,DNS_T_NS)) flagns = 1;
@@ -154,8 +302,8 @@ static int doit(char *q,char qtype[2])
   for (;;) {
     addrnum = 0;
     addrttl = 0;
-    cdb_findstart(&c);
-    while (r = find(wild,wild != q)) {
+    if (findstart(wild,1) == -1) return 0;
+    while (r = find(wild != q)) {
       if (r == -1) return 0;
       flagfound = 1;
       if (flaggavesoa && byte_equal(type,2,DNS_T_SOA)) continue;
@@ -189,6 +337,11 @@ static int doit(char *q,char qtype[2])
         if (!response_addbytes(data + dpos,dlen - dpos)) return 0;
       response_rfinish(RESPONSE_ANSWER);
     }
+    if (addrnum > 8) flagvolatile = 1;
+    if (addrnum > 1) {
+      shufflepos = response_len;
+      shufflenum = addrnum;
+    }
     for (i = 0;i < addrnum;++i)
       if (i < 8) {
 	if (!response_rstart(q,DNS_T_A,addrttl)) return 0;
@@ -211,8 +364,8 @@ static int doit(char *q,char qtype[2])
   aupos = response_len;
 
   if (flagauthoritative && (aupos == anpos)) {
-    cdb_findstart(&c);
-    while (r = find(control,0)) {
+    if (findstart(control,1) == -1) return 0;
+    while (r = find(0)) {
       if (r == -1) return 0;
       if (byte_equal(type,2,DNS_T_SOA)) {
         if (!response_rstart(control,DNS_T_SOA,ttl)) return 0;
@@ -226,8 +379,8 @@ static int doit(char *q,char qtype[2])
   }
   else
     if (want(control,DNS_T_NS)) {
-      cdb_findstart(&c);
-      while (r = find(control,0)) {
+      if (findstart(control,1) == -1) return 0;
+      while (r = find(0)) {
         if (r == -1) return 0;
         if (byte_equal(type,2,DNS_T_NS)) {
           if (!response_rstart(control,DNS_T_NS,ttl)) return 0;
@@ -251,8 +404,8 @@ static int doit(char *q,char qtype[2])
         if (!dns_packet_getname(response,arpos,bpos + 2,&d1)) return 0;
       case_lowerb(d1,dns_domain_length(d1));
       if (want(d1,DNS_T_A)) {
-	cdb_findstart(&c);
-	while (r = find(d1,0)) {
+	if (findstart(d1,0) == -1) return 0;
+	while (r = find(0)) {
           if (r == -1) return 0;
 	  if (byte_equal(type,2,DNS_T_A)) {
             if (!response_rstart(d1,DNS_T_A,ttl)) return 0;
@@ -278,33 +431,121 @@ static int doit(char *q,char qtype[2])
   return 1;
 }
 
+/*
+Answer cache: the header bits, counts, and sections after the question,
+keyed on qtype, client location, and q; flushed when data.cdb changes.
+Answers that depend on the time, or that pick 8 of more than 8 A
+records, are not kept. A hit gets its A records (16 bytes each, owner
+compressed to the question) shuffled again, as doit() would have.
+*/
+
+static int flagcache = 0;
+static unsigned int cachesize;
+static uint32 cachegen;
+static char cachekey[4 + 255];
+static unsigned int cachekeylen;
+static char *cachebuf = 0; /* 12 + 65535 bytes, only with the cache */
+
+int tdlookup_cache(unsigned int size)
+{
+  cachesize = size;
+  flagcache = 0;
+  if (!size) return 1;
+  if (!cachebuf) cachebuf = alloc(12 + 65535);
+  if (!cachebuf) return 0;
+  if (!cache_init(size)) return 0;
+  cachegen = datacdb_generation;
+  flagcache = 1;
+  return 1;
+}
+
+static int cached(unsigned int anpos)
+{
+  char *x;
+  unsigned int len;
+  uint32 u;
+  uint16 pos;
+  unsigned int num;
+  unsigned int i;
+  unsigned int j;
+  char rr[16];
+
+  x = cache_get(cachekey,cachekeylen,&len,&u);
+  if (!x) return 0;
+  if (len < 12) return 0;
+  if (!response_addbytes(x + 12,len - 12)) return 0;
+  response[2] &= ~4;
+  response[2] |= x[0] & 4;
+  response[3] &= ~15;
+  response[3] |= x[1] & 15;
+  byte_copy(response + 6,6,x + 2);
+
+  uint16_unpack_big(x + 8,&pos);
+  num = (unsigned char) x[10];
+  if (num > 1)
+    if (anpos + pos + 16 * num <= response_len)
+      for (i = num - 1;i > 0;--i) {
+        j = dns_random(i + 1);
+        byte_copy(rr,16,response + anpos + pos + 16 * i);
+        byte_copy(response + anpos + pos + 16 * i,16,response + anpos + pos + 16 * j);
+        byte_copy(response + anpos + pos + 16 * j,16,rr);
+      }
+  return 1;
+}
+
+static void save(unsigned int anpos)
+{
+  unsigned int len;
+
+  len = response_len - anpos;
+  if (len > 65535) return;
+  if (shufflenum && (shufflepos - anpos > 65535)) return;
+  cachebuf[0] = response[2] & 4;
+  cachebuf[1] = response[3] & 15;
+  byte_copy(cachebuf + 2,6,response + 6);
+  uint16_pack_big(cachebuf + 8,shufflenum ? shufflepos - anpos : 0);
+  cachebuf[10] = shufflenum;
+  cachebuf[11] = 0;
+  byte_copy(cachebuf + 12,len,response + anpos);
+  cache_set(cachekey,cachekeylen,cachebuf,len + 12,604800);
+}
+
+static int flagloc = 0;
+static uint32 locgen;
+
 int respond(char *q,char qtype[2],char ip[4])
 {
-  int fd;
   int r;
-  char key[6];
+  unsigned int anpos;
 
   tai_now(&now);
-  fd = open_read("data.cdb");
-  if (fd == -1) return 0;
-  cdb_init(&c,fd);
-
-  byte_zero(clientloc,2);
-  key[0] = 0;
-  key[1] = '%';
-  byte_copy(key + 2,4,ip);
-  r = cdb_find(&c,key,6);
-  if (!r) r = cdb_find(&c,key,5);
-  if (!r) r = cdb_find(&c,key,4);
-  if (!r) r = cdb_find(&c,key,3);
-  if (!r) r = cdb_find(&c,key,2);
-  if (r == -1) return 0;
-  if (r && (cdb_datalen(&c) == 2))
-    if (cdb_read(&c,clientloc,2,cdb_datapos(&c)) == -1) return 0;
+  if (!datacdb(&c)) return 0;
 
-  r = doit(q,qtype);
+  if (!flagloc || (locgen != datacdb_generation)) {
+    if (!clientloc_load(&c,"\0%",2)) { flagloc = 0; return 0; }
+    locgen = datacdb_generation;
+    flagloc = 1;
+  }
+  clientloc_find(clientloc,ip);
+
+  if (!flagcache) return doit(q,qtype);
 
-  cdb_free(&c);
-  close(fd);
+  if (cachegen != datacdb_generation) {
+    if (!cache_init(cachesize)) { flagcache = 0; return doit(q,qtype); }
+    cachegen = datacdb_generation;
+  }
+  cache_clock(&now);
+  anpos = response_len;
+  cachekeylen = dns_domain_length(q);
+  byte_copy(cachekey,2,qtype);
+  byte_copy(cachekey + 2,2,clientloc);
+  byte_copy(cachekey + 4,cachekeylen,q);
+  cachekeylen += 4;
+  if (cached(anpos)) return 1;
+
+  flagvolatile = 0;
+  shufflenum = 0;
+  r = doit(q,qtype);
+  if (r && !flagvolatile) save(anpos);
   return r;
 }
@@ -0,0 +1,101 @@
+#include "uint64.h"
+#include "timer.h"
+
+/*
+Hashed timing wheel: TIMER_SLOTS slots of 1/TIMER_HZ second each.
+A timer sits in the slot for its tick; timers more than one turn
+away share slots with nearer ones and are skipped until due.
+cur is the earliest tick that may still hold expired timers.
+*/
+
+#define TIMER_HZ 64
+#define TIMER_SLOTS 1024
+
+static struct timer wheel[TIMER_SLOTS];
+static uint64 cur = 0;
+static int flagstarted = 0;
+
+static uint64 tick(const struct taia *t)
+{
+  return t->sec.x * TIMER_HZ + t->nano / (1000000000 / TIMER_HZ);
+}
+
+static void start(uint64 k)
+{
+  int i;
+
+  if (flagstarted) return;
+  for (i = 0;i < TIMER_SLOTS;++i)
+    wheel[i].next = wheel[i].prev = wheel + i;
+  cur = k;
+  flagstarted = 1;
+}
+
+void timer_clear(struct timer *t)
+{
+  if (!t->next) return;
+  t->next->prev = t->prev;
+  t->prev->next = t->next;
+  t->next = t->prev = 0;
+}
+
+void timer_set(struct timer *t,const struct taia *when)
+{
+  struct timer *head;
+  uint64 k;
+
+  timer_clear(t);
+  k = tick(when);
+  start(k);
+  if (k < cur) k = cur;
+  t->when = *when;
+  head = wheel + (k & (TIMER_SLOTS - 1));
+  t->next = head->next;
+  t->prev = head;
+  head->next->prev = t;
+  head->next = t;
+}
+
+struct timer *timer_expired(const struct taia *now)
+{
+  struct timer *head;
+  struct timer *t;
+  uint64 k;
+
+  if (!flagstarted) return 0;
+  k = tick(now);
+  if (k > cur + TIMER_SLOTS) cur = k - TIMER_SLOTS;
+
+  for (;;) {
+    head = wheel + (cur & (TIMER_SLOTS - 1));
+    for (t = head->next;t != head;t = t->next)
+      if (!taia_less(now,&t->when)) {
+        timer_clear(t);
+        return t;
+      }
+    if (cur >= k) return 0;
+    ++cur;
+  }
+}
+
+void timer_next(struct taia *deadline)
+{
+  struct timer *head;
+  struct timer *t;
+  struct taia *best;
+  int i;
+
+  if (!flagstarted) return;
+  for (i = 0;i < TIMER_SLOTS;++i) {
+    head = wheel + ((cur + i) & (TIMER_SLOTS - 1));
+    best = 0;
+    for (t = head->next;t != head;t = t->next)
+      if (tick(&t->when) <= cur + i)
+        if (!best || taia_less(&t->when,best))
+          best = &t->when;
+    if (best) {
+      if (taia_less(best,deadline)) *deadline = *best;
+      return;
+    }
+  }
+}
@@ -0,0 +1,18 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "taia.h"
+
+struct timer {
+  struct taia when;
+  struct timer *next; /* 0 if not armed */
+  struct timer *prev;
+  unsigned int data;
+} ;
+
+extern void timer_set(struct timer *,const struct taia *);
+extern void timer_clear(struct timer *);
+extern void timer_next(struct taia *);
+extern struct timer *timer_expired(const struct taia *);
+
+#endif
@@ -2,6 +2,8 @@
 #include <pwd.h>
 #include "strerr.h"
 #include "exit.h"
+#include "scan.h"
+#include "fmt.h"
 #include "auto_home.h"
 #include "generic-conf.h"
 
@@ -9,7 +11,7 @@
 
 void usage(void)
 {
-  strerr_die1x(100,"tinydns-conf: usage: tinydns-conf acct logacct /tinydns myip");
+  strerr_die1x(100,"tinydns-conf: usage: tinydns-conf acct logacct /tinydns myip [cachesize]");
 }
 
 char *dir;
@@ -17,6 +19,9 @@ char *user;
 char *loguser;
 struct passwd *pw;
 char *myip;
+unsigned long cachesize = 0;
+unsigned long datalimit = 300000;
+char strnum[FMT_ULONG];
 
 int main(int argc,char **argv)
 {
@@ -29,6 +34,9 @@ int main(int argc,char **argv)
   if (dir[0] != '/') usage();
   myip = argv[4];
   if (!myip) usage();
+  if (argv[5]) scan_ulong(argv[5],&cachesize);
+  if (cachesize) /* plus the answer buffer and malloc slack */
+    datalimit += cachesize + 200000;
 
   pw = getpwnam(loguser);
   if (!pw)
@@ -43,10 +51,14 @@ int main(int argc,char **argv)
   perm(0644);
   start("env/IP"); outs(myip); outs("\n"); finish();
   perm(0644);
+  start("env/CACHESIZE"); out(strnum,fmt_ulong(strnum,cachesize)); outs("\n"); finish();
+  perm(0644);
 
   start("run");
   outs("#!/bin/sh\nexec 2>&1\nexec envuidgid "); outs(user);
-  outs(" envdir ./env softlimit -d300000 ");
+  outs(" envdir ./env softlimit -d");
+  out(strnum,fmt_ulong(strnum,datalimit));
+  outs(" ");
   outs(auto_home); outs("/bin/tinydns\n");
   finish();
   perm(0755);
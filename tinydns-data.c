@@ -2,6 +2,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include "uint16.h"
 #include "uint32.h"
 #include "str.h"
@@ -14,15 +15,23 @@
 #include "buffer.h"
 #include "strerr.h"
 #include "getln.h"
+#include "cdb.h"
 #include "cdb_make.h"
+#include "alloc.h"
+#include "error.h"
 #include "stralloc.h"
 #include "open.h"
+#include "seek.h"
+#include "taia.h"
 #include "dns.h"
+#include "sgetopt.h"
 
 #define TTL_NS 259200
 #define TTL_POSITIVE 86400
 #define TTL_NEGATIVE 2560
 
+#define JOBS 64
+
 #define FATAL "tinydns-data: fatal: "
 
 void die_datatmp(void)
@@ -33,6 +42,14 @@ void nomem(void)
 {
   strerr_die1sys(111,FATAL);
 }
+void die_datajob(void)
+{
+  strerr_die2sys(111,FATAL,"unable to write data.job: ");
+}
+void die_idxtmp(void)
+{
+  strerr_die2sys(111,FATAL,"unable to create data.idx.tmp: ");
+}
 
 void ttdparse(stralloc *sa,char ttd[8])
 {
@@ -59,22 +76,40 @@ void locparse(stralloc *sa,char loc[2])
   loc[1] = (sa->len > 1) ? sa->s[1] : 0;
 }
 
+/* a.b.c, or a.b.c.d/n: 4 bytes, then n unless n is a multiple of 8 */
 void ipprefix_cat(stralloc *out,char *s)
 {
   unsigned long u;
   char ch;
   unsigned int j;
+  unsigned int start;
 
+  start = out->len;
   for (;;)
     if (*s == '.')
       ++s;
     else {
       j = scan_ulong(s,&u);
-      if (!j) return;
+      if (!j) break;
       s += j;
       ch = u;
       if (!stralloc_catb(out,&ch,1)) nomem();
     }
+
+  if (*s != '/') return;
+  if (out->len - start > 4) return;
+  if (!scan_ulong(s + 1,&u)) return;
+  if (u > 32) u = 32;
+  if (!stralloc_catb(out,"\0\0\0\0",4)) nomem();
+  out->len = start + 4;
+  for (j = u;j < 32;++j)
+    out->s[start + j / 8] &= ~(128 >> (j & 7));
+  if (u & 7) {
+    ch = u;
+    if (!stralloc_catb(out,&ch,1)) nomem();
+  }
+  else
+    out->len = start + u / 8;
 }
 
 void txtparse(stralloc *sa)
@@ -125,6 +160,25 @@ struct cdb_make cdb;
 static stralloc key;
 static stralloc result;
 
+int jobfd = -1; /* in a parse job: records go here, not to data.tmp */
+buffer jobb;
+char jobspace[8192];
+
+void add(const char *k,unsigned int klen,const char *d,unsigned int dlen)
+{
+  char buf[8];
+
+  if (jobfd == -1) {
+    if (cdb_make_add(&cdb,k,klen,d,dlen) == -1) die_datatmp();
+    return;
+  }
+  uint32_pack(buf,klen);
+  uint32_pack(buf + 4,dlen);
+  if (buffer_put(&jobb,buf,8) == -1) die_datajob();
+  if (buffer_put(&jobb,k,klen) == -1) die_datajob();
+  if (buffer_put(&jobb,d,dlen) == -1) die_datajob();
+}
+
 void rr_add(const char *buf,unsigned int len)
 {
   if (!stralloc_catb(&result,buf,len)) nomem();
@@ -155,16 +209,17 @@ void rr_finish(const char *owner)
   }
   if (!stralloc_copyb(&key,owner,dns_domain_length(owner))) nomem();
   case_lowerb(key.s,key.len);
-  if (cdb_make_add(&cdb,key.s,key.len,result.s,result.len) == -1)
-    die_datatmp();
+  add(key.s,key.len,result.s,result.len);
 }
 
+int fddata;
 buffer b;
 char bspace[1024];
 
 static stralloc line;
 int match = 1;
 unsigned long linenum = 0;
+unsigned long start = 0; /* offset in data of the first line parsed here */
 
 #define NUMFIELDS 15
 static stralloc f[NUMFIELDS];
@@ -177,13 +232,218 @@ char strnum[FMT_ULONG];
 
 void syntaxerror(const char *why)
 {
+  unsigned long pos = 0;
+
+  if (start) {
+    if (seek_begin(fddata) == -1)
+      strerr_die2sys(111,FATAL,"unable to read data: ");
+    buffer_init(&b,buffer_unixread,fddata,bspace,sizeof bspace);
+    while (pos < start) {
+      if (getln(&b,&line,&match,'\n') == -1)
+        strerr_die2sys(111,FATAL,"unable to read line: ");
+      if (!match) break;
+      pos += line.len;
+      ++linenum;
+    }
+  }
   strnum[fmt_ulong(strnum,linenum)] = 0;
   strerr_die4x(111,FATAL,"unable to parse data line ",strnum,why);
 }
 
-int main()
+int getall(buffer *bb,char *buf,unsigned int len)
 {
-  int fddata;
+  int r;
+
+  while (len > 0) {
+    r = buffer_get(bb,buf,len);
+    if (r == -1) return -1;
+    if (!r) { errno = error_proto; return -1; }
+    buf += r;
+    len -= r;
+  }
+  return 0;
+}
+
+/*
+-i: data.idx says, for each line of data, where the records made from
+it lie in data.cdb. The next tinydns-data -i copies the records of each
+unchanged line from the old data.cdb instead of parsing the line again.
+Lines starting with . or Z are always parsed: their default SOA serial
+is the mtime of data.
+*/
+
+#define IDX_MAGIC "tdidx\0\0\1"
+#define IDX_HEADER 44
+#define IDX_AHEAD 3
+
+struct idx {
+  uint64 h;
+  uint32 linelen;
+  uint32 pos;
+  uint32 len;
+} ;
+
+int flaginc = 0;
+struct cdb old;
+struct idx *idx; /* old data.idx, in the order of the old data */
+uint32 idxold = 0;
+uint32 idxnext = 0; /* where the next line is expected in idx */
+uint32 *idxtab = 0; /* 1 + position in idx, by h; built on first miss */
+uint32 idxslots;
+int fdidx;
+buffer bidx;
+char bidxspace[8192];
+uint32 idxnum = 0;
+
+void pack64(char s[8],uint64 u)
+{
+  uint32_pack(s,u);
+  uint32_pack(s + 4,u >> 32);
+}
+
+/* what data.idx starts with when it describes the data.cdb in st */
+void idxheader(char hdr[IDX_HEADER],struct stat *st,const char *cdbheader,int version,uint32 num)
+{
+  byte_copy(hdr,8,IDX_MAGIC);
+  uint32_pack(hdr + 8,version);
+  uint32_pack(hdr + 12,num);
+  uint32_pack(hdr + 16,st->st_size);
+  pack64(hdr + 20,st->st_mtime);
+  pack64(hdr + 28,st->st_ino);
+  pack64(hdr + 36,cdb_hash2(cdbheader,2048));
+}
+
+void idxload(int version)
+{
+  char hdr[IDX_HEADER];
+  char want[IDX_HEADER];
+  char buf[20];
+  struct stat st;
+  struct idx *e;
+  uint32 num;
+  uint32 i;
+  uint32 u;
+  int fd;
+
+  fd = open_read("data.cdb");
+  if (fd == -1) return;
+  if (fstat(fd,&st) == -1) return;
+  cdb_init(&old,fd);
+  if (!old.map || (old.size < 2048)) return;
+
+  fd = open_read("data.idx");
+  if (fd == -1) return;
+  buffer_init(&bidx,buffer_unixread,fd,bidxspace,sizeof bidxspace);
+  if (getall(&bidx,hdr,IDX_HEADER) == -1) goto DONE;
+  uint32_unpack(hdr + 12,&num);
+  idxheader(want,&st,old.map,version,num);
+  if (byte_diff(hdr,IDX_HEADER,want)) goto DONE;
+  if (num > 0x0fffffff) goto DONE;
+
+  idx = (struct idx *) alloc(num * sizeof(struct idx) + 1);
+  if (!idx) nomem();
+  for (i = 0;i < num;++i) {
+    e = idx + i;
+    if (getall(&bidx,buf,20) == -1) goto DONE;
+    uint32_unpack(buf,&u); e->h = u;
+    uint32_unpack(buf + 4,&u); e->h += (uint64) u << 32;
+    uint32_unpack(buf + 8,&e->linelen);
+    uint32_unpack(buf + 12,&e->pos);
+    uint32_unpack(buf + 16,&e->len);
+    if ((e->pos < 2048) || (e->pos > old.size)) goto DONE;
+    if (e->len > old.size - e->pos) goto DONE;
+  }
+  idxold = num;
+
+  DONE:
+  close(fd);
+}
+
+void idxtabinit(void)
+{
+  uint32 i;
+  uint32 j;
+
+  idxslots = idxold * 2 + 1;
+  idxtab = (uint32 *) alloc(idxslots * sizeof(uint32));
+  if (!idxtab) nomem();
+  for (j = 0;j < idxslots;++j) idxtab[j] = 0;
+  for (i = 0;i < idxold;++i) {
+    j = idx[i].h % idxslots;
+    while (idxtab[j])
+      if (++j == idxslots) j = 0;
+    idxtab[j] = i + 1;
+  }
+}
+
+/* position in idx of the line with hash h, or idxold */
+uint32 idxfind(uint64 h)
+{
+  uint32 i;
+  uint32 j;
+
+  for (i = idxnext;(i < idxold) && (i < idxnext + IDX_AHEAD);++i)
+    if ((idx[i].h == h) && (idx[i].linelen == line.len)) return i;
+
+  if (!idxold) return idxold;
+  if (!idxtab) idxtabinit();
+  j = h % idxslots;
+  while (idxtab[j]) {
+    i = idxtab[j] - 1;
+    if ((idx[i].h == h) && (idx[i].linelen == line.len)) return i;
+    if (++j == idxslots) j = 0;
+  }
+  return idxold;
+}
+
+void idxadd(uint64 h,uint32 pos)
+{
+  char buf[20];
+
+  pack64(buf,h);
+  uint32_pack(buf + 8,line.len);
+  uint32_pack(buf + 12,pos);
+  uint32_pack(buf + 16,cdb.pos - pos);
+  if (buffer_put(&bidx,buf,20) == -1) die_idxtmp();
+  ++idxnum;
+}
+
+/* copy the records of an unchanged line from the old data.cdb */
+int reuse(uint64 h)
+{
+  uint32 i;
+  uint32 pos;
+  uint32 end;
+  uint32 klen;
+  uint32 dlen;
+
+  i = idxfind(h);
+  if (i == idxold) return 0;
+
+  end = idx[i].pos + idx[i].len;
+  for (pos = idx[i].pos;pos < end;pos += 8 + klen + dlen) {
+    if (end - pos < 8) return 0;
+    uint32_unpack(old.map + pos,&klen);
+    uint32_unpack(old.map + pos + 4,&dlen);
+    if (klen > end - pos - 8) return 0;
+    if (dlen > end - pos - 8 - klen) return 0;
+  }
+  for (pos = idx[i].pos;pos < end;pos += 8 + klen + dlen) {
+    uint32_unpack(old.map + pos,&klen);
+    uint32_unpack(old.map + pos + 4,&dlen);
+    add(old.map + pos + 8,klen,old.map + pos + 8 + klen,dlen);
+  }
+  idxnext = i + 1;
+  return 1;
+}
+
+/* parse lines of data until len bytes have been read */
+void parse(unsigned long len)
+{
+  unsigned long pos = 0;
+  int flagidx;
+  uint64 h = 0;
+  uint32 blockpos = 0;
   int i;
   int j;
   int k;
@@ -197,23 +457,11 @@ int main()
   char soa[20];
   char buf[4];
 
-  umask(022);
-
-  fddata = open_read("data");
-  if (fddata == -1)
-    strerr_die2sys(111,FATAL,"unable to open data: ");
-  defaultsoa_init(fddata);
-
-  buffer_init(&b,buffer_unixread,fddata,bspace,sizeof bspace);
-
-  fdcdb = open_trunc("data.tmp");
-  if (fdcdb == -1) die_datatmp();
-  if (cdb_make_start(&cdb,fdcdb) == -1) die_datatmp();
-
-  while (match) {
+  while (match && (pos < len)) {
     ++linenum;
     if (getln(&b,&line,&match,'\n') == -1)
       strerr_die2sys(111,FATAL,"unable to read line: ");
+    pos += line.len;
 
     while (line.len) {
       ch = line.s[line.len - 1];
@@ -224,6 +472,16 @@ int main()
     if (line.s[0] == '#') continue;
     if (line.s[0] == '-') continue;
 
+    flagidx = flaginc && (line.s[0] != '.') && (line.s[0] != 'Z');
+    if (flagidx) {
+      h = cdb_hash2(line.s,line.len);
+      blockpos = cdb.pos;
+      if (reuse(h)) {
+	idxadd(h,blockpos);
+	continue;
+      }
+    }
+
     j = 1;
     for (i = 0;i < NUMFIELDS;++i) {
       if (j >= line.len) {
@@ -243,8 +501,7 @@ int main()
 	if (!stralloc_copyb(&key,"\0%",2)) nomem();
 	if (!stralloc_0(&f[1])) nomem();
 	ipprefix_cat(&key,f[1].s);
-        if (cdb_make_add(&cdb,key.s,key.len,loc,2) == -1)
-          die_datatmp();
+        add(key.s,key.len,loc,2);
 	break;
 
       case 'Z':
@@ -444,13 +701,206 @@ int main()
       default:
         syntaxerror(": unrecognized leading character");
     }
+
+    if (flagidx) idxadd(h,blockpos);
   }
+}
+
+/* offset of the first line starting at or after pos */
+unsigned long linestart(unsigned long pos)
+{
+  char ch;
+  int r;
+
+  if (!pos) return 0;
+  if (seek_set(fddata,pos - 1) == -1)
+    strerr_die2sys(111,FATAL,"unable to read data: ");
+  buffer_init(&b,buffer_unixread,fddata,bspace,sizeof bspace);
+  for (;;) {
+    r = buffer_get(&b,&ch,1);
+    if (r == -1) strerr_die2sys(111,FATAL,"unable to read data: ");
+    if (!r || (ch == '\n')) return pos;
+    ++pos;
+  }
+}
+
+void jobget(char *buf,unsigned int len)
+{
+  if (getall(&jobb,buf,len) == -1)
+    strerr_die2sys(111,FATAL,"unable to read data.job: ");
+}
+
+/* copy the records of a finished parse job into data.tmp */
+void merge(int fd)
+{
+  char buf[8];
+  uint32 klen;
+  uint32 dlen;
+  int r;
+
+  buffer_init(&jobb,buffer_unixread,fd,jobspace,sizeof jobspace);
+  for (;;) {
+    r = buffer_feed(&jobb);
+    if (r == -1) strerr_die2sys(111,FATAL,"unable to read data.job: ");
+    if (!r) break;
+    jobget(buf,8);
+    uint32_unpack(buf,&klen);
+    uint32_unpack(buf + 4,&dlen);
+    if (!stralloc_ready(&key,klen)) nomem();
+    if (!stralloc_ready(&result,dlen)) nomem();
+    jobget(key.s,klen);
+    jobget(result.s,dlen);
+    if (cdb_make_add(&cdb,key.s,klen,result.s,dlen) == -1) die_datatmp();
+  }
+  close(fd);
+}
+
+int flagtime = 0;
+struct taia phasestart;
+
+void phase(const char *what)
+{
+  struct taia now;
+  struct taia elapsed;
+
+  if (!flagtime) return;
+  taia_now(&now);
+  taia_sub(&elapsed,&now,&phasestart);
+  phasestart = now;
+  strnum[fmt_ulong(strnum,(unsigned long) (taia_approx(&elapsed) * 1000.0))] = 0;
+  strerr_warn5("tinydns-data: ",what,": ",strnum," ms",0);
+}
+
+int main(int argc,char **argv)
+{
+  int opt;
+  int flagcdb2 = 0;
+  unsigned long jobs = 1;
+  unsigned long parsejobs;
+  char hdr[IDX_HEADER];
+  unsigned long cut[JOBS + 1];
+  int jobfds[JOBS];
+  pid_t pids[JOBS];
+  struct stat st;
+  int wstat;
+  int fd;
+  unsigned int j;
 
-  if (cdb_make_finish(&cdb) == -1) die_datatmp();
+  while ((opt = getopt(argc,argv,"2ij:t")) != opteof)
+    switch(opt) {
+      case '2':
+	flagcdb2 = 1;
+	break;
+      case 'j':
+	if (!scan_ulong(optarg,&jobs)) jobs = 1;
+	break;
+      case 'i':
+	flaginc = 1;
+	break;
+      case 't':
+	flagtime = 1;
+	break;
+      default:
+	strerr_die1x(100,"tinydns-data: usage: tinydns-data [ -2 ] [ -i ] [ -j jobs ] [ -t ]");
+    }
+  if (jobs < 1) jobs = 1;
+  if (jobs > JOBS) jobs = JOBS;
+  parsejobs = flaginc ? 1 : jobs; /* -i parses in order, in one process */
+
+  umask(022);
+  taia_now(&phasestart);
+
+  fddata = open_read("data");
+  if (fddata == -1)
+    strerr_die2sys(111,FATAL,"unable to open data: ");
+  defaultsoa_init(fddata);
+
+  fdcdb = open_trunc("data.tmp");
+  if (fdcdb == -1) die_datatmp();
+  if ((flagcdb2 ? cdb_make_start2(&cdb,fdcdb) : cdb_make_start(&cdb,fdcdb)) == -1) die_datatmp();
+
+  if (flaginc) {
+    idxload(cdb.version);
+    fdidx = open_trunc("data.idx.tmp");
+    if (fdidx == -1) die_idxtmp();
+    buffer_init(&bidx,buffer_unixwrite,fdidx,bidxspace,sizeof bidxspace);
+    byte_zero(hdr,IDX_HEADER);
+    if (buffer_put(&bidx,hdr,IDX_HEADER) == -1) die_idxtmp();
+  }
+
+  /* job j parses the lines from cut[j] to cut[j + 1] */
+  if (fstat(fddata,&st) == -1)
+    strerr_die2sys(111,FATAL,"unable to stat data: ");
+  cut[0] = 0;
+  for (j = 1;j < parsejobs;++j) {
+    cut[j] = linestart((st.st_size / parsejobs) * j);
+    if (cut[j] < cut[j - 1]) cut[j] = cut[j - 1];
+  }
+  cut[parsejobs] = (unsigned long) -1;
+
+  for (j = 1;j < parsejobs;++j) {
+    fd = open_trunc("data.job");
+    if (fd == -1) die_datajob();
+    jobfds[j] = open_read("data.job");
+    if (jobfds[j] == -1) die_datajob();
+    unlink("data.job");
+    pids[j] = fork();
+    if (pids[j] == -1)
+      strerr_die2sys(111,FATAL,"unable to fork: ");
+    if (pids[j] == 0) {
+      jobfd = fd;
+      buffer_init(&jobb,buffer_unixwrite,jobfd,jobspace,sizeof jobspace);
+      fddata = open_read("data");
+      if (fddata == -1)
+        strerr_die2sys(111,FATAL,"unable to open data: ");
+      if (seek_set(fddata,cut[j]) == -1)
+        strerr_die2sys(111,FATAL,"unable to read data: ");
+      buffer_init(&b,buffer_unixread,fddata,bspace,sizeof bspace);
+      start = cut[j];
+      parse(cut[j + 1] - cut[j]);
+      if (buffer_flush(&jobb) == -1) die_datajob();
+      _exit(0);
+    }
+    close(fd);
+  }
+
+  if (seek_begin(fddata) == -1)
+    strerr_die2sys(111,FATAL,"unable to read data: ");
+  buffer_init(&b,buffer_unixread,fddata,bspace,sizeof bspace);
+  parse(cut[1]);
+
+  for (j = 1;j < parsejobs;++j) {
+    if (waitpid(pids[j],&wstat,0) == -1)
+      strerr_die2sys(111,FATAL,"unable to wait for parse job: ");
+    if (!WIFEXITED(wstat))
+      strerr_die2x(111,FATAL,"parse job crashed");
+    if (WEXITSTATUS(wstat)) _exit(111);
+  }
+  phase("parse");
+
+  for (j = 1;j < parsejobs;++j)
+    merge(jobfds[j]);
+  phase("merge");
+
+  if (cdb_make_finishn(&cdb,jobs) == -1) die_datatmp();
+  phase("finish");
   if (fsync(fdcdb) == -1) die_datatmp();
+  if (flaginc) {
+    if (fstat(fdcdb,&st) == -1) die_datatmp();
+    idxheader(hdr,&st,cdb.final,cdb.version,idxnum);
+    if (buffer_flush(&bidx) == -1) die_idxtmp();
+    if (seek_begin(fdidx) == -1) die_idxtmp();
+    if (buffer_putflush(&bidx,hdr,IDX_HEADER) == -1) die_idxtmp();
+    if (fsync(fdidx) == -1) die_idxtmp();
+    if (close(fdidx) == -1) die_idxtmp();
+  }
   if (close(fdcdb) == -1) die_datatmp(); /* NFS stupidity */
   if (rename("data.tmp","data.cdb") == -1)
     strerr_die2sys(111,FATAL,"unable to move data.tmp to data.cdb: ");
+  if (flaginc)
+    if (rename("data.idx.tmp","data.idx") == -1)
+      strerr_die2sys(111,FATAL,"unable to move data.idx.tmp to data.idx: ");
+  phase("sync");
 
   _exit(0);
 }
@@ -10,10 +10,18 @@
 #include "strerr.h"
 #include "scan.h"
 #include "byte.h"
+#include "case.h"
 #include "str.h"
 #include "fmt.h"
 #include "ip4.h"
+#include "seek.h"
+#include "alloc.h"
+#include "gen_alloc.h"
+#include "gen_allocdefs.h"
+#include "cdb.h"
+#include "cdb_make.h"
 #include "dns.h"
+#include "error.h"
 
 #define FATAL "tinydns-edit: fatal: "
 
@@ -22,10 +30,12 @@
 
 char *fn;
 char *fnnew;
+stralloc fnix = {0};
+stralloc fnixtmp = {0};
 
 void die_usage()
 {
-  strerr_die1x(100,"tinydns-edit: usage: tinydns-edit data data.new add [ns|childns|host|alias|mx] domain a.b.c.d");
+  strerr_die1x(100,"tinydns-edit: usage: tinydns-edit data data.new { add [ns|childns|host|alias|mx] domain a.b.c.d | add < edits | compact }");
 }
 void nomem()
 {
@@ -39,10 +49,18 @@ void die_write()
 {
   strerr_die4sys(100,FATAL,"tinydns-edit: fatal: unable to write ",fnnew,": ");
 }
-
-char mode;
-static char *target;
-char targetip[4];
+void die_append()
+{
+  strerr_die4sys(111,FATAL,"unable to append to ",fn,": ");
+}
+void die_readix()
+{
+  strerr_die4sys(111,FATAL,"unable to read ",fnix.s,": ");
+}
+void die_writeix()
+{
+  strerr_die4sys(111,FATAL,"unable to write ",fnixtmp.s,": ");
+}
 
 int fd;
 buffer b;
@@ -64,194 +82,553 @@ char ip[4];
 char ipstr[IP4_FMT];
 char strnum[FMT_ULONG];
 
-static char *names[26];
-static int used[26];
-
 void put(const char *buf,unsigned int len)
 {
   if (buffer_putalign(&bnew,buf,len) == -1) die_write();
 }
 
-int main(int argc,char **argv)
-{
+/*
+Names in use: for each domain under ., &, or @ lines, the letters taken
+by its a.ns, b.ns, ... or a.mx, b.mx, ... servers and the ttl of its
+last line; for each domain under = lines, the name and the address.
+Kept in memory for the lines read here, and in fn.names for the first
+part of fn, so that an edit reads only what was added since.
+*/
+
+struct name {
+  unsigned int key; /* position in keys */
+  unsigned int keylen;
+  uint32 mask; /* bit i: letter 'a' + i */
   unsigned long ttl;
-  struct stat st;
-  int i;
-  int j;
-  int k;
-  char ch;
+  unsigned int next; /* 1 + next name in this hash chain */
+} ;
 
-  if (!*argv) die_usage();
+GEN_ALLOC_typedef(name_alloc,struct name,s,len,a)
+GEN_ALLOC_readyplus(name_alloc,struct name,s,len,a,i,n,x,30,name_alloc_readyplus)
+GEN_ALLOC_append(name_alloc,struct name,s,len,a,i,n,x,30,name_alloc_readyplus,name_alloc_append)
 
-  if (!*++argv) die_usage();
-  fn = *argv;
+static name_alloc names;
+static stralloc keys;
+static unsigned int *heads;
+static unsigned int headsize = 0;
 
-  if (!*++argv) die_usage();
-  fnnew = *argv;
+static void rehash(void)
+{
+  unsigned int i;
+  unsigned int h;
+
+  if (heads) alloc_free(heads);
+  headsize = headsize ? headsize * 2 : 256;
+  heads = (unsigned int *) alloc(headsize * sizeof(unsigned int));
+  if (!heads) nomem();
+  for (i = 0;i < headsize;++i) heads[i] = 0;
+  for (i = 0;i < names.len;++i) {
+    h = cdb_hash2(keys.s + names.s[i].key,names.s[i].keylen) & (headsize - 1);
+    names.s[i].next = heads[h];
+    heads[h] = i + 1;
+  }
+}
 
-  if (!*++argv) die_usage();
-  if (str_diff(*argv,"add")) die_usage();
+static struct name *find(const char *key,unsigned int len,int flagcreate)
+{
+  struct name n;
+  unsigned int i;
+  unsigned int h;
+
+  if (headsize) {
+    h = cdb_hash2(key,len) & (headsize - 1);
+    for (i = heads[h];i;i = names.s[i - 1].next)
+      if (names.s[i - 1].keylen == len)
+	if (byte_equal(keys.s + names.s[i - 1].key,len,key))
+	  return names.s + i - 1;
+  }
+  if (!flagcreate) return 0;
+
+  if (names.len >= headsize) rehash();
+  n.key = keys.len;
+  n.keylen = len;
+  n.mask = 0;
+  n.ttl = 0;
+  h = cdb_hash2(key,len) & (headsize - 1);
+  n.next = heads[h];
+  if (!stralloc_catb(&keys,key,len)) nomem();
+  if (!name_alloc_append(&names,&n)) nomem();
+  heads[h] = names.len;
+  return names.s + names.len - 1;
+}
 
-  if (!*++argv) die_usage();
-  if (str_equal(*argv,"ns")) mode = '.';
-  else if (str_equal(*argv,"childns")) mode = '&';
-  else if (str_equal(*argv,"host")) mode = '=';
-  else if (str_equal(*argv,"alias")) mode = '+';
-  else if (str_equal(*argv,"mx")) mode = '@';
-  else die_usage();
+static stralloc key;
 
-  if (!*++argv) die_usage();
-  if (!dns_domain_fromdot(&target,*argv,str_len(*argv))) nomem();
+static void keyset(char type,const char *d,unsigned int len)
+{
+  if (!stralloc_copyb(&key,&type,1)) nomem();
+  if (!stralloc_catb(&key,d,len)) nomem();
+  case_lowerb(key.s + 1,len);
+}
 
-  if (!*++argv) die_usage();
-  if (!ip4_scan(*argv,targetip)) die_usage();
+char mode;
+static char *target;
+char targetip[4];
 
-  umask(077);
+int flagall = 1; /* otherwise only the names of the one command are kept */
+static stralloc want1;
+static stralloc want2;
 
-  fd = open_read(fn);
-  if (fd == -1) die_read();
-  if (fstat(fd,&st) == -1) die_read();
-  buffer_init(&b,buffer_unixread,fd,bspace,sizeof bspace);
+/* the entry for key, created if need be; 0 if key is of no interest */
+static struct name *keep(void)
+{
+  if (!flagall)
+    if ((key.len != want1.len) || byte_diff(key.s,key.len,want1.s))
+      if ((key.len != want2.len) || byte_diff(key.s,key.len,want2.s))
+	return 0;
+  return find(key.s,key.len,1);
+}
 
-  fdnew = open_trunc(fnnew);
-  if (fdnew == -1) die_write();
-  if (fchmod(fdnew,st.st_mode & 0644) == -1) die_write();
-  buffer_init(&bnew,buffer_unixwrite,fdnew,bnewspace,sizeof bnewspace);
+/* record the names used by the line in line */
+void note(void)
+{
+  struct name *n;
+  const char *server;
+  unsigned long ttl;
+  unsigned int i;
+  unsigned int j;
+  unsigned int k;
+  char ch;
 
-  switch(mode) {
-    case '.': case '&':
-      ttl = TTL_NS;
-      for (i = 0;i < 26;++i) {
-	ch = 'a' + i;
-	if (!stralloc_copyb(&f[0],&ch,1)) nomem();
-	if (!stralloc_cats(&f[0],".ns.")) nomem();
-	if (!dns_domain_todot_cat(&f[0],target)) nomem();
-	if (!dns_domain_fromdot(&names[i],f[0].s,f[0].len)) nomem();
-      }
-      break;
-    case '+': case '=':
-      ttl = TTL_POSITIVE;
-      break;
-    case '@':
-      ttl = TTL_POSITIVE;
-      for (i = 0;i < 26;++i) {
-	ch = 'a' + i;
-	if (!stralloc_copyb(&f[0],&ch,1)) nomem();
-	if (!stralloc_cats(&f[0],".mx.")) nomem();
-	if (!dns_domain_todot_cat(&f[0],target)) nomem();
-	if (!dns_domain_fromdot(&names[i],f[0].s,f[0].len)) nomem();
-      }
+  while (line.len) {
+    ch = line.s[line.len - 1];
+    if ((ch != ' ') && (ch != '\t') && (ch != '\n')) break;
+    --line.len;
+  }
+  if (!line.len) return;
+
+  switch(line.s[0]) {
+    case '.': case '&': case '@': case '=':
       break;
+    default:
+      return;
   }
+  if (!flagall && (line.s[0] != mode)) return;
 
-  while (match) {
-    if (getln(&b,&line,&match,'\n') == -1) die_read();
+  j = 1;
+  for (i = 0;i < NUMFIELDS;++i) {
+    if (j >= line.len) {
+      if (!stralloc_copys(&f[i],"")) nomem();
+    }
+    else {
+      k = byte_chr(line.s + j,line.len - j,':');
+      if (!stralloc_copyb(&f[i],line.s + j,k)) nomem();
+      j += k + 1;
+    }
+  }
 
-    put(line.s,line.len);
-    if (line.len && !match) put("\n",1);
+  if (!dns_domain_fromdot(&d1,f[0].s,f[0].len)) nomem();
 
-    while (line.len) {
-      ch = line.s[line.len - 1];
-      if ((ch != ' ') && (ch != '\t') && (ch != '\n')) break;
-      --line.len;
+  if (line.s[0] == '=') {
+    keyset('=',d1,dns_domain_length(d1));
+    keep();
+    if (!stralloc_0(&f[1])) nomem();
+    if (ip4_scan(f[1].s,ip)) {
+      keyset('i',ip,4);
+      keep();
     }
-    if (!line.len) continue;
-    if (line.s[0] == '#') continue;
+    return;
+  }
 
-    j = 1;
-    for (i = 0;i < NUMFIELDS;++i) {
-      if (j >= line.len) {
-	if (!stralloc_copys(&f[i],"")) nomem();
-      }
-      else {
-        k = byte_chr(line.s + j,line.len - j,':');
-	if (!stralloc_copyb(&f[i],line.s + j,k)) nomem();
-	j += k + 1;
-      }
+  server = (line.s[0] == '@') ? "mx" : "ns";
+  if (byte_chr(f[2].s,f[2].len,'.') >= f[2].len) {
+    if (!stralloc_cats(&f[2],".")) nomem();
+    if (!stralloc_cats(&f[2],server)) nomem();
+    if (!stralloc_cats(&f[2],".")) nomem();
+    if (!stralloc_catb(&f[2],f[0].s,f[0].len)) nomem();
+  }
+  if (!dns_domain_fromdot(&d2,f[2].s,f[2].len)) nomem();
+  if (line.s[0] == '@') {
+    if (!stralloc_0(&f[4])) nomem();
+    if (!scan_ulong(f[4].s,&ttl)) ttl = TTL_POSITIVE;
+  }
+  else {
+    if (!stralloc_0(&f[3])) nomem();
+    if (!scan_ulong(f[3].s,&ttl)) ttl = TTL_NS;
+  }
+
+  keyset(line.s[0],d1,dns_domain_length(d1));
+  n = keep();
+  if (!n) return;
+  n->ttl = ttl;
+
+  /* d2 is x.ns.d1 or x.mx.d1 for a letter x */
+  if (d2[0] != 1) return;
+  ch = d2[1];
+  if ((ch >= 'A') && (ch <= 'Z')) ch += 'a' - 'A';
+  if ((ch < 'a') || (ch > 'z')) return;
+  if (d2[2] != 2) return;
+  if (case_diffb(d2 + 3,2,server)) return;
+  if (!dns_domain_equal(d2 + 5,d1)) return;
+  n->mask |= (uint32) 1 << (ch - 'a');
+}
+
+int flagix = 0; /* fn.names is current for fn up to ixlen */
+int flagixold = 0; /* fn.names exists */
+struct cdb ix;
+unsigned long ixlen;
+
+void pack64(char s[8],uint64 u)
+{
+  uint32_pack(s,u);
+  uint32_pack(s + 4,u >> 32);
+}
+
+/*
+what fn.names records under the empty key: fn, open as fdfn, up to len.
+The hash covers all len bytes, so an edit anywhere in them is noticed;
+it costs one sequential read of fn.
+*/
+void ixheader(char hdr[24],int fdfn,struct stat *st,unsigned long len)
+{
+  static char buf[8 + 65536];
+  unsigned long pos;
+  unsigned int n;
+  unsigned int i;
+  uint64 h;
+  int r;
+
+  pack64(hdr,len);
+  pack64(hdr + 8,st->st_ino);
+  if (seek_set(fdfn,0) == -1) die_read();
+  h = 0;
+  for (pos = 0;pos < len;pos += n) {
+    n = (len - pos < 65536) ? len - pos : 65536;
+    for (i = 0;i < n;i += r) {
+      r = read(fdfn,buf + 8 + i,n - i);
+      if (r <= 0) die_read();
     }
+    pack64(buf,h); /* chained: each block's hash covers those before it */
+    h = cdb_hash2(buf,8 + n);
+  }
+  pack64(hdr + 16,h);
+}
 
-    switch(mode) {
-      case '.': case '&':
-	if (line.s[0] == mode) {
-          if (!dns_domain_fromdot(&d1,f[0].s,f[0].len)) nomem();
-	  if (dns_domain_equal(d1,target)) {
-	    if (byte_chr(f[2].s,f[2].len,'.') >= f[2].len) {
-	      if (!stralloc_cats(&f[2],".ns.")) nomem();
-	      if (!stralloc_catb(&f[2],f[0].s,f[0].len)) nomem();
-	    }
-	    if (!dns_domain_fromdot(&d2,f[2].s,f[2].len)) nomem();
-	    if (!stralloc_0(&f[3])) nomem();
-	    if (!scan_ulong(f[3].s,&ttl)) ttl = TTL_NS;
-	    for (i = 0;i < 26;++i)
-	      if (dns_domain_equal(d2,names[i])) {
-	        used[i] = 1;
-		break;
-	      }
-	  }
-	}
-	break;
-
-      case '=':
-	if (line.s[0] == '=') {
-	  if (!dns_domain_fromdot(&d1,f[0].s,f[0].len)) nomem();
-	  if (dns_domain_equal(d1,target))
-	    strerr_die2x(100,FATAL,"host name already used");
-	  if (!stralloc_0(&f[1])) nomem();
-	  if (ip4_scan(f[1].s,ip))
-	    if (byte_equal(ip,4,targetip))
-	      strerr_die2x(100,FATAL,"IP address already used");
-	}
-	break;
-
-      case '@':
-	if (line.s[0] == '@') {
-          if (!dns_domain_fromdot(&d1,f[0].s,f[0].len)) nomem();
-	  if (dns_domain_equal(d1,target)) {
-	    if (byte_chr(f[2].s,f[2].len,'.') >= f[2].len) {
-	      if (!stralloc_cats(&f[2],".mx.")) nomem();
-	      if (!stralloc_catb(&f[2],f[0].s,f[0].len)) nomem();
-	    }
-	    if (!dns_domain_fromdot(&d2,f[2].s,f[2].len)) nomem();
-	    if (!stralloc_0(&f[4])) nomem();
-	    if (!scan_ulong(f[4].s,&ttl)) ttl = TTL_POSITIVE;
-	    for (i = 0;i < 26;++i)
-	      if (dns_domain_equal(d2,names[i])) {
-	        used[i] = 1;
-		break;
-	      }
-	  }
-	}
-	break;
+void ixopen(struct stat *st)
+{
+  char hdr[24];
+  char want[24];
+  uint32 u;
+  int fdix;
+  int r;
+
+  fdix = open_read(fnix.s);
+  if (fdix == -1) return;
+  flagixold = 1;
+  cdb_init(&ix,fdix);
+  r = cdb_find(&ix,"",0);
+  if (r == -1) die_readix();
+  if (!r || (cdb_datalen(&ix) != 24)) return;
+  if (cdb_read(&ix,hdr,24,cdb_datapos(&ix)) == -1) die_readix();
+  uint32_unpack(hdr + 4,&u);
+  if (u) return;
+  uint32_unpack(hdr,&u);
+  ixlen = u;
+  if (ixlen > st->st_size) return;
+  ixheader(want,fd,st,ixlen);
+  if (byte_diff(hdr,24,want)) return;
+  flagix = 1;
+}
+
+/* 1 if key is in use; then its letters and ttl */
+int lookup(uint32 *mask,unsigned long *ttl)
+{
+  struct name *n;
+  char buf[8];
+  uint32 u;
+  int flagfound = 0;
+  int r;
+
+  *mask = 0;
+  if (flagix) {
+    r = cdb_find(&ix,key.s,key.len);
+    if (r == -1) die_readix();
+    if (r) {
+      flagfound = 1;
+      if (cdb_datalen(&ix) != 8) die_readix();
+      if (cdb_read(&ix,buf,8,cdb_datapos(&ix)) == -1) die_readix();
+      uint32_unpack(buf,mask);
+      uint32_unpack(buf + 4,&u);
+      *ttl = u;
     }
   }
+  n = find(key.s,key.len,0);
+  if (n) {
+    flagfound = 1;
+    *mask |= n->mask;
+    *ttl = n->ttl;
+  }
+  return flagfound;
+}
+
+static stralloc out;
+
+/* add a mode line for target to out, after checking what is in use */
+void add(void)
+{
+  unsigned long ttl;
+  uint32 mask;
+  int i;
+  char ch;
+
+  ttl = ((mode == '.') || (mode == '&')) ? TTL_NS : TTL_POSITIVE;
+  mask = 0;
+  switch(mode) {
+    case '.': case '&': case '@':
+      keyset(mode,target,dns_domain_length(target));
+      lookup(&mask,&ttl);
+      break;
+    case '=':
+      keyset('=',target,dns_domain_length(target));
+      if (lookup(&mask,&ttl))
+	strerr_die2x(100,FATAL,"host name already used");
+      keyset('i',targetip,4);
+      if (lookup(&mask,&ttl))
+	strerr_die2x(100,FATAL,"IP address already used");
+      break;
+  }
 
-  if (!stralloc_copyb(&f[0],&mode,1)) nomem();
-  if (!dns_domain_todot_cat(&f[0],target)) nomem();
-  if (!stralloc_cats(&f[0],":")) nomem();
-  if (!stralloc_catb(&f[0],ipstr,ip4_fmt(ipstr,targetip))) nomem();
+  if (!stralloc_copyb(&line,&mode,1)) nomem();
+  if (!dns_domain_todot_cat(&line,target)) nomem();
+  if (!stralloc_cats(&line,":")) nomem();
+  if (!stralloc_catb(&line,ipstr,ip4_fmt(ipstr,targetip))) nomem();
   switch(mode) {
     case '.': case '&': case '@':
       for (i = 0;i < 26;++i)
-	if (!used[i])
+	if (!(mask & ((uint32) 1 << i)))
 	  break;
       if (i >= 26)
 	strerr_die2x(100,FATAL,"too many records for that domain");
       ch = 'a' + i;
-      if (!stralloc_cats(&f[0],":")) nomem();
-      if (!stralloc_catb(&f[0],&ch,1)) nomem();
+      if (!stralloc_cats(&line,":")) nomem();
+      if (!stralloc_catb(&line,&ch,1)) nomem();
       if (mode == '@')
-        if (!stralloc_cats(&f[0],":")) nomem();
+        if (!stralloc_cats(&line,":")) nomem();
       break;
   }
-  if (!stralloc_cats(&f[0],":")) nomem();
-  if (!stralloc_catb(&f[0],strnum,fmt_ulong(strnum,ttl))) nomem();
-  if (!stralloc_cats(&f[0],"\n")) nomem();
-  put(f[0].s,f[0].len);
+  if (!stralloc_cats(&line,":")) nomem();
+  if (!stralloc_catb(&line,strnum,fmt_ulong(strnum,ttl))) nomem();
+  if (!stralloc_cats(&line,"\n")) nomem();
+  if (!stralloc_cat(&out,&line)) nomem();
+  note();
+}
 
+int command(char **argv)
+{
+  if (!argv[0]) return 0;
+  if (str_equal(argv[0],"ns")) mode = '.';
+  else if (str_equal(argv[0],"childns")) mode = '&';
+  else if (str_equal(argv[0],"host")) mode = '=';
+  else if (str_equal(argv[0],"alias")) mode = '+';
+  else if (str_equal(argv[0],"mx")) mode = '@';
+  else return 0;
+
+  if (!argv[1]) return 0;
+  if (!dns_domain_fromdot(&target,argv[1],str_len(argv[1]))) nomem();
+
+  if (!argv[2]) return 0;
+  if (!ip4_scan(argv[2],targetip)) return 0;
+  if (argv[3]) return 0;
+  return 1;
+}
+
+buffer bin;
+char binspace[1024];
+stralloc cmd;
+
+/* commands on stdin, one per line: type domain a.b.c.d */
+void batch(void)
+{
+  char *args[5];
+  unsigned long linenum = 0;
+  unsigned int i;
+  int j;
+  int flagmatch = 1;
+
+  buffer_init(&bin,buffer_unixread,0,binspace,sizeof binspace);
+  while (flagmatch) {
+    if (getln(&bin,&cmd,&flagmatch,'\n') == -1)
+      strerr_die2sys(111,FATAL,"unable to read input: ");
+    ++linenum;
+    if (!stralloc_0(&cmd)) nomem();
+    j = 0;
+    for (i = 0;i < cmd.len;++i)
+      switch(cmd.s[i]) {
+	case ' ': case '\t': case '\n': case 0:
+	  cmd.s[i] = 0;
+	  break;
+	default:
+	  if (!i || !cmd.s[i - 1]) {
+	    if (j == 4) break;
+	    args[j++] = cmd.s + i;
+	  }
+      }
+    if (!j) continue;
+    args[j] = 0;
+    if (!command(args)) {
+      strnum[fmt_ulong(strnum,linenum)] = 0;
+      strerr_die3x(100,FATAL,"unable to parse input line ",strnum);
+    }
+    add();
+  }
+}
+
+/* build fn.names from the names in memory, describing fn up to len */
+void ixwrite(int fdfn,struct stat *st,unsigned long len)
+{
+  struct cdb_make c;
+  char hdr[24];
+  char buf[8];
+  unsigned int i;
+  int fdix;
+
+  if (len > 0xffffffff)
+    strerr_die3x(111,FATAL,fn," is too large to index");
+  ixheader(hdr,fdfn,st,len);
+  fdix = open_trunc(fnixtmp.s);
+  if (fdix == -1) die_writeix();
+  if (cdb_make_start(&c,fdix) == -1) die_writeix();
+  if (cdb_make_add(&c,"",0,hdr,24) == -1) die_writeix();
+  for (i = 0;i < names.len;++i) {
+    uint32_pack(buf,names.s[i].mask);
+    uint32_pack(buf + 4,names.s[i].ttl);
+    if (cdb_make_add(&c,keys.s + names.s[i].key,names.s[i].keylen,buf,8) == -1) die_writeix();
+  }
+  if (cdb_make_finish(&c) == -1) die_writeix();
+  if (fsync(fdix) == -1) die_writeix();
+  if (close(fdix) == -1) die_writeix();
+  if (rename(fnixtmp.s,fnix.s) == -1)
+    strerr_die6sys(111,FATAL,"unable to move ",fnixtmp.s," to ",fnix.s,": ");
+}
+
+int main(int argc,char **argv)
+{
+  struct stat st;
+  int flagcompact = 0;
+  char ch;
+  unsigned int i;
+  int r;
+  int e;
+
+  if (!*argv) die_usage();
+
+  if (!*++argv) die_usage();
+  fn = *argv;
+
+  if (!*++argv) die_usage();
+  fnnew = *argv;
+
+  if (!*++argv) die_usage();
+  if (str_equal(*argv,"compact"))
+    flagcompact = 1;
+  else if (str_diff(*argv,"add")) die_usage();
+  else if (*++argv)
+    if (!command(argv)) die_usage();
+
+  if (!stralloc_copys(&fnix,fn)) nomem();
+  if (!stralloc_cats(&fnix,".names")) nomem();
+  if (!stralloc_0(&fnix)) nomem();
+  if (!stralloc_copy(&fnixtmp,&fnix)) nomem();
+  --fnixtmp.len;
+  if (!stralloc_cats(&fnixtmp,".tmp")) nomem();
+  if (!stralloc_0(&fnixtmp)) nomem();
+
+  umask(077);
+
+  fd = open_read(fn);
+  if (fd == -1) die_read();
+  if (fstat(fd,&st) == -1) die_read();
+
+  if (!flagcompact) ixopen(&st);
+
+  /* one edit, and no fn.names to bring up to date: keep only its names */
+  if (*argv && !flagcompact && !flagixold) {
+    flagall = 0;
+    keyset(mode,target,dns_domain_length(target));
+    if (!stralloc_copy(&want1,&key)) nomem();
+    if (mode == '=') {
+      keyset('=',target,dns_domain_length(target));
+      if (!stralloc_copy(&want1,&key)) nomem();
+      keyset('i',targetip,4);
+      if (!stralloc_copy(&want2,&key)) nomem();
+    }
+  }
+
+  /* with a current fn.names, read only the lines after ixlen */
+  if (seek_set(fd,flagix ? ixlen : 0) == -1) die_read();
+  if (!flagix && !flagcompact) {
+    fdnew = open_trunc(fnnew);
+    if (fdnew == -1) die_write();
+    if (fchmod(fdnew,st.st_mode & 0644) == -1) die_write();
+    buffer_init(&bnew,buffer_unixwrite,fdnew,bnewspace,sizeof bnewspace);
+  }
+  buffer_init(&b,buffer_unixread,fd,bspace,sizeof bspace);
+
+  while (match) {
+    if (getln(&b,&line,&match,'\n') == -1) die_read();
+    if (!flagix && !flagcompact) {
+      put(line.s,line.len);
+      if (line.len && !match) put("\n",1);
+    }
+    note();
+  }
+
+  if (flagcompact) {
+    ixwrite(fd,&st,st.st_size);
+    _exit(0);
+  }
+
+  if (*argv)
+    add();
+  else
+    batch();
+
+  if (flagix) {
+    /* O_APPEND: the lines go at the end; a reader may see part of them */
+    ch = '\n';
+    if (st.st_size > 0) {
+      if (seek_set(fd,st.st_size - 1) == -1) die_read();
+      if (read(fd,&ch,1) != 1) die_read();
+    }
+    if (ch != '\n') {
+      if (!stralloc_copyb(&line,"\n",1)) nomem();
+      if (!stralloc_cat(&line,&out)) nomem();
+      if (!stralloc_copy(&out,&line)) nomem();
+    }
+    fdnew = open_append(fn);
+    if (fdnew == -1) die_append();
+    for (i = 0;i < out.len;i += r) {
+      r = write(fdnew,out.s + i,out.len - i);
+      if (r <= 0) {
+        e = errno;
+        ftruncate(fdnew,st.st_size); /* no partial line left in fn */
+        errno = e;
+        die_append();
+      }
+    }
+    if (fsync(fdnew) == -1) die_append();
+    if (close(fdnew) == -1) die_append();
+    _exit(0);
+  }
+
+  put(out.s,out.len);
   if (buffer_flush(&bnew) == -1) die_write();
   if (fsync(fdnew) == -1) die_write();
   if (close(fdnew) == -1) die_write(); /* NFS dorks */
   if (rename(fnnew,fn) == -1)
     strerr_die6sys(111,FATAL,"unable to move ",fnnew," to ",fn,": ");
+
+  /* everything is in memory now, so bring an old fn.names up to date */
+  if (flagixold) {
+    fd = open_read(fn);
+    if (fd == -1) die_read();
+    if (fstat(fd,&st) == -1) die_read();
+    ixwrite(fd,&st,st.st_size);
+  }
   _exit(0);
 }
@@ -1,4 +1,9 @@
 #include "dns.h"
+#include "env.h"
+#include "scan.h"
+#include "strerr.h"
+
+extern int tdlookup_cache(unsigned int);
 
 const char *fatal = "tinydns: fatal: ";
 const char *starting = "starting tinydns\n";
@@ -7,5 +12,14 @@ static char seed[128];
 
 void initialize(void)
 {
+  char *x;
+  unsigned long cachesize;
+
   dns_random_init(seed);
+
+  cachesize = 0;
+  x = env_get("CACHESIZE");
+  if (x) scan_ulong(x,&cachesize);
+  if (!tdlookup_cache(cachesize))
+    strerr_die2x(111,fatal,"not enough memory for answer cache");
 }
@@ -0,0 +1,14 @@
+#include <sys/epoll.h>
+
+int main()
+{
+  struct epoll_event ev;
+  int fd;
+
+  fd = epoll_create(1);
+  if (fd == -1) _exit(1);
+  ev.events = EPOLLIN;
+  ev.data.u64 = 0;
+  if (epoll_wait(fd,&ev,1,0) == -1) _exit(1);
+  _exit(0);
+}
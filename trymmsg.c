@@ -0,0 +1,14 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+
+int main()
+{
+  struct mmsghdr m[2];
+
+  m[0].msg_hdr.msg_name = 0;
+  m[0].msg_len = 0;
+  recvmmsg(-1,m,2,MSG_WAITFORONE,0);
+  sendmmsg(-1,m,2,0);
+  _exit(0);
+}
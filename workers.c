@@ -0,0 +1,115 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include "byte.h"
+#include "error.h"
+#include "strerr.h"
+#include "workers.h"
+
+static pid_t pids[WORKERS_MAX];
+static unsigned int numpids = 0;
+static int flagterm = 0;
+static int flagusr1 = 0;
+
+static void sigterm(int sig)
+{
+  flagterm = 1;
+}
+
+static void sigusr1(int sig)
+{
+  flagusr1 = 1;
+}
+
+static void catch(int sig,void (*f)(int))
+{
+  struct sigaction sa;
+
+  byte_zero(&sa,sizeof sa);
+  sa.sa_handler = f;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0; /* no SA_RESTART: waitpid must see EINTR */
+  sigaction(sig,&sa,(struct sigaction *) 0);
+}
+
+static void killall(int sig)
+{
+  unsigned int i;
+
+  for (i = 0;i < numpids;++i)
+    if (pids[i]) kill(pids[i],sig);
+}
+
+static void reap(pid_t pid)
+{
+  unsigned int i;
+
+  for (i = 0;i < numpids;++i)
+    if (pids[i] == pid) pids[i] = 0;
+}
+
+static int anyleft(void)
+{
+  unsigned int i;
+
+  for (i = 0;i < numpids;++i)
+    if (pids[i]) return 1;
+  return 0;
+}
+
+/*
+Returns the worker number, 0 through n-1, in each of n worker processes.
+The parent never returns: it waits for the workers, takes them all down
+as soon as one of them exits or the parent is asked to terminate, and
+then exits so that supervise restarts the whole set.
+SIGUSR1 to the parent is passed on to every worker; workers start
+out ignoring it.
+*/
+
+unsigned int workers_start(unsigned int n,const char *fatal)
+{
+  unsigned int i;
+  pid_t pid;
+  int wstat;
+
+  if (n <= 1) return 0;
+  if (n > WORKERS_MAX) n = WORKERS_MAX;
+
+  catch(SIGTERM,sigterm);
+  catch(SIGUSR1,sigusr1);
+
+  for (i = 0;i < n;++i) {
+    pid = fork();
+    if (pid == -1) {
+      killall(SIGTERM);
+      strerr_die2sys(111,fatal,"unable to fork: ");
+    }
+    if (pid == 0) {
+      catch(SIGTERM,SIG_DFL);
+      catch(SIGUSR1,SIG_IGN);
+      return i;
+    }
+    pids[numpids++] = pid;
+  }
+
+  for (;;) {
+    pid = waitpid(-1,&wstat,0);
+    if (pid > 0) { reap(pid); break; }
+    if (errno != error_intr) break;
+    if (flagterm) break;
+    if (flagusr1) {
+      flagusr1 = 0;
+      killall(SIGUSR1);
+    }
+  }
+
+  killall(SIGTERM);
+  while (anyleft()) {
+    pid = waitpid(-1,&wstat,0);
+    if (pid > 0) reap(pid);
+    else if (errno != error_intr) break;
+  }
+
+  _exit(flagterm ? 0 : 111);
+}
@@ -0,0 +1,8 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#define WORKERS_MAX 64
+
+extern unsigned int workers_start(unsigned int,const char *);
+
+#endif